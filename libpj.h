@@ -4,13 +4,32 @@
 #include <assert.h>
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#if defined(__linux__) && !defined(PJ_NO_IO_URING) &&                          \
+    __has_include(<linux/io_uring.h>)
+#define __PJ_IO_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#endif // __linux__
+
+#if defined(__AVX2__) || defined(__BMI2__)
+#include <immintrin.h>
+#endif // __AVX2__ || __BMI2__
 
 /* Temporary buffer */
 #define __TMP_BUF_LEN 1024
@@ -54,11 +73,6 @@ static char __buf[__TMP_BUF_LEN] = {0};
     (x) = __t;                                                                 \
   } while (0);
 
-static inline void __print_int(int x) { printf("%d\n", x); }
-static inline void __print_str(char *x) { printf("%s\n", x); }
-#define print(x) _Generic((x), int: __print_int, char *: __print_str)(x);
-#define println(fmt, ...) (printf(fmt "\n", __VA_ARGS__))
-
 #define MAX(x, y) ((x) > (y) ? (x) : (y))
 #define MIN(x, y) ((x) < (y) ? (x) : (y))
 
@@ -68,6 +82,34 @@ static inline void __print_str(char *x) { printf("%s\n", x); }
 
 #define loop(i) for (size_t __i = 0; __i < (i); ++__i)
 
+/* __PP_MAP(m, a, b, ...) expands to m(a) m(b) ..., for up to 16 arguments */
+#define __PP_CAT(a, b) __PP_CAT_(a, b)
+#define __PP_CAT_(a, b) a##b
+#define __PP_NARGS(...)                                                        \
+  __PP_NARGS_(__VA_ARGS__, 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, \
+              1)
+#define __PP_NARGS_(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13,    \
+                    _14, _15, _16, n, ...)                                     \
+  n
+#define __PP_MAP(m, ...)                                                       \
+  __PP_CAT(__PP_MAP_, __PP_NARGS(__VA_ARGS__))(m, __VA_ARGS__)
+#define __PP_MAP_1(m, x) m(x)
+#define __PP_MAP_2(m, x, ...) m(x) __PP_MAP_1(m, __VA_ARGS__)
+#define __PP_MAP_3(m, x, ...) m(x) __PP_MAP_2(m, __VA_ARGS__)
+#define __PP_MAP_4(m, x, ...) m(x) __PP_MAP_3(m, __VA_ARGS__)
+#define __PP_MAP_5(m, x, ...) m(x) __PP_MAP_4(m, __VA_ARGS__)
+#define __PP_MAP_6(m, x, ...) m(x) __PP_MAP_5(m, __VA_ARGS__)
+#define __PP_MAP_7(m, x, ...) m(x) __PP_MAP_6(m, __VA_ARGS__)
+#define __PP_MAP_8(m, x, ...) m(x) __PP_MAP_7(m, __VA_ARGS__)
+#define __PP_MAP_9(m, x, ...) m(x) __PP_MAP_8(m, __VA_ARGS__)
+#define __PP_MAP_10(m, x, ...) m(x) __PP_MAP_9(m, __VA_ARGS__)
+#define __PP_MAP_11(m, x, ...) m(x) __PP_MAP_10(m, __VA_ARGS__)
+#define __PP_MAP_12(m, x, ...) m(x) __PP_MAP_11(m, __VA_ARGS__)
+#define __PP_MAP_13(m, x, ...) m(x) __PP_MAP_12(m, __VA_ARGS__)
+#define __PP_MAP_14(m, x, ...) m(x) __PP_MAP_13(m, __VA_ARGS__)
+#define __PP_MAP_15(m, x, ...) m(x) __PP_MAP_14(m, __VA_ARGS__)
+#define __PP_MAP_16(m, x, ...) m(x) __PP_MAP_15(m, __VA_ARGS__)
+
 /* End: Useful macros */
 
 /* Start: Types */
@@ -89,6 +131,263 @@ typedef struct {
 
 /* End: Types */
 
+/* Start: Profiling */
+/*
+   Counters, latency histograms and scoped timers, compiled in only when
+   PJ_PROFILE is defined; otherwise every prof_* macro expands to nothing.
+   PJ_PROFILE_PROBES additionally enables the built-in probes in da_reserve,
+   ht_insert and sb_read_file. Timings are in nanoseconds, or in TSC cycles
+   with PJ_PROFILE_TSC.
+
+   ```
+   prof_count("parse.lines");            // Named event counter
+   prof_add("parse.bytes", n);
+   prof_record("batch.size", n);         // Add a value to a histogram
+   {
+     prof_scope("parse");                // Time until the end of the scope
+     ...
+   }
+   prof_dump(stderr);
+   ```
+
+   Every thread writes to its own block, prof_dump and prof_hist sum the
+   blocks of all threads that ever recorded something. Histograms are
+   log-linear: values below 8 are exact, above that each power of two is
+   split in 8 buckets, so percentiles are within 12.5%.
+*/
+#define PROF_MAX 64
+#define __PROF_SUB 8
+#define __PROF_BUCKETS (62 * __PROF_SUB)
+
+typedef struct {
+  u64 count;
+  u64 sum;
+  u64 min;
+  u64 max;
+  u64 buckets[__PROF_BUCKETS];
+} Prof_Hist;
+
+static inline size_t __prof_bucket(u64 v) {
+  if (v < __PROF_SUB)
+    return v;
+  size_t e = 63 - __builtin_clzll(v);
+  return (e - 2) * __PROF_SUB + ((v >> (e - 3)) & (__PROF_SUB - 1));
+}
+
+/* Smallest value that falls in bucket b */
+static inline u64 __prof_bucket_min(size_t b) {
+  if (b < __PROF_SUB)
+    return b;
+  size_t e = b / __PROF_SUB + 2;
+  return (u64)(__PROF_SUB + b % __PROF_SUB) << (e - 3);
+}
+
+static inline void __prof_hist_add(Prof_Hist *h, u64 v) {
+  h->min = h->count ? MIN(h->min, v) : v;
+  h->max = MAX(h->max, v);
+  h->count++;
+  h->sum += v;
+  h->buckets[__prof_bucket(v)]++;
+}
+
+/* Lower bound of the bucket holding the p-th percentile, 0 < p <= 100 */
+static inline u64 prof_percentile(const Prof_Hist *h, double p) {
+  if (!h->count)
+    return 0;
+  double r = p / 100 * h->count;
+  u64 rank = MAX((u64)r + ((double)(u64)r < r), 1llu), seen = 0;
+  for (size_t b = 0; b < __PROF_BUCKETS; ++b) {
+    seen += h->buckets[b];
+    if (seen >= rank)
+      return MIN(MAX(__prof_bucket_min(b), h->min), h->max);
+  }
+  return h->max;
+}
+
+#ifdef PJ_PROFILE
+#include <time.h>
+#ifdef PJ_PROFILE_TSC
+#include <x86intrin.h>
+#endif // PJ_PROFILE_TSC
+
+typedef struct __prof_thread {
+  u64 counters[PROF_MAX];
+  Prof_Hist *hists[PROF_MAX];
+  struct __prof_thread *next;
+} __prof_thread;
+
+static const char *__prof_names[PROF_MAX];
+static size_t __prof_nnames;
+static __prof_thread *__prof_threads;
+static pthread_mutex_t __prof_lock = PTHREAD_MUTEX_INITIALIZER;
+static _Thread_local __prof_thread *__prof_self;
+
+static inline u64 __prof_now(void) {
+#ifdef PJ_PROFILE_TSC
+  return __rdtsc();
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (u64)ts.tv_sec * 1000000000llu + ts.tv_nsec;
+#endif // PJ_PROFILE_TSC
+}
+
+static inline int __prof_register(const char *name) {
+  pthread_mutex_lock(&__prof_lock);
+  size_t i;
+  for (i = 0; i < __prof_nnames; ++i) {
+    if (matches(__prof_names[i], name))
+      break;
+  }
+  if (i == __prof_nnames) {
+    assert(__prof_nnames < PROF_MAX && "Too many profiling names");
+    __prof_names[__prof_nnames++] = name;
+  }
+  pthread_mutex_unlock(&__prof_lock);
+  return i;
+}
+
+/* Every call site resolves its name once */
+#define __prof_id(name)                                                        \
+  ({                                                                           \
+    static _Atomic int __pid = -1;                                             \
+    if (__pid < 0)                                                             \
+      __pid = __prof_register((name));                                         \
+    (size_t)__pid;                                                             \
+  })
+
+static inline __prof_thread *__prof_thread_get(void) {
+  if (!__prof_self) {
+    __prof_self = calloc(1, sizeof(__prof_thread));
+    assert(__prof_self);
+    pthread_mutex_lock(&__prof_lock);
+    __prof_self->next = __prof_threads;
+    __prof_threads = __prof_self;
+    pthread_mutex_unlock(&__prof_lock);
+  }
+  return __prof_self;
+}
+
+static inline void __prof_record(size_t id, u64 v) {
+  __prof_thread *t = __prof_thread_get();
+  if (!t->hists[id]) {
+    t->hists[id] = calloc(1, sizeof(Prof_Hist));
+    assert(t->hists[id]);
+  }
+  __prof_hist_add(t->hists[id], v);
+}
+
+typedef struct {
+  u64 start;
+  size_t id;
+} __prof_scope_t;
+
+static inline void __prof_scope_end(__prof_scope_t *scope) {
+  __prof_record(scope->id, __prof_now() - scope->start);
+}
+
+#define prof_add(name, n)                                                      \
+  (__prof_thread_get()->counters[__prof_id(name)] += (n))
+#define prof_count(name) prof_add((name), 1)
+#define prof_record(name, v) __prof_record(__prof_id(name), (v))
+#define prof_scope(name)                                                       \
+  __attribute__((cleanup(__prof_scope_end)))                                   \
+  __prof_scope_t __PP_CAT(__prof_scope_, __LINE__) = {.start = __prof_now(),   \
+                                                      .id = __prof_id(name)}
+
+/* Counter `name` summed over all threads */
+static inline u64 prof_counter(const char *name) {
+  u64 n = 0;
+  pthread_mutex_lock(&__prof_lock);
+  for (size_t i = 0; i < __prof_nnames; ++i) {
+    if (!matches(__prof_names[i], name))
+      continue;
+    for (__prof_thread *t = __prof_threads; t; t = t->next) {
+      n += t->counters[i];
+    }
+  }
+  pthread_mutex_unlock(&__prof_lock);
+  return n;
+}
+
+/* Histogram `name` merged over all threads */
+static inline Prof_Hist prof_hist(const char *name) {
+  Prof_Hist h = {0};
+  pthread_mutex_lock(&__prof_lock);
+  for (size_t i = 0; i < __prof_nnames; ++i) {
+    if (!matches(__prof_names[i], name))
+      continue;
+    for (__prof_thread *t = __prof_threads; t; t = t->next) {
+      Prof_Hist *th = t->hists[i];
+      if (!th || !th->count)
+        continue;
+      h.min = h.count ? MIN(h.min, th->min) : th->min;
+      h.max = MAX(h.max, th->max);
+      h.count += th->count;
+      h.sum += th->sum;
+      for (size_t b = 0; b < __PROF_BUCKETS; ++b) {
+        h.buckets[b] += th->buckets[b];
+      }
+    }
+  }
+  pthread_mutex_unlock(&__prof_lock);
+  return h;
+}
+
+static inline void prof_dump(FILE *fp) {
+  pthread_mutex_lock(&__prof_lock);
+  size_t n = __prof_nnames;
+  pthread_mutex_unlock(&__prof_lock);
+
+  for (size_t i = 0; i < n; ++i) {
+    u64 c = prof_counter(__prof_names[i]);
+    Prof_Hist h = prof_hist(__prof_names[i]);
+    if (c) {
+      fprintf(fp, "%-24s count %llu\n", __prof_names[i], (unsigned long long)c);
+    }
+    if (h.count) {
+      fprintf(fp,
+              "%-24s n %llu mean %.1f p50 %llu p90 %llu p99 %llu p99.9 %llu "
+              "max %llu\n",
+              __prof_names[i], (unsigned long long)h.count,
+              (double)h.sum / h.count,
+              (unsigned long long)prof_percentile(&h, 50),
+              (unsigned long long)prof_percentile(&h, 90),
+              (unsigned long long)prof_percentile(&h, 99),
+              (unsigned long long)prof_percentile(&h, 99.9),
+              (unsigned long long)h.max);
+    }
+  }
+}
+
+static inline void prof_reset(void) {
+  pthread_mutex_lock(&__prof_lock);
+  for (__prof_thread *t = __prof_threads; t; t = t->next) {
+    memset(t->counters, 0, sizeof(t->counters));
+    for (size_t i = 0; i < PROF_MAX; ++i) {
+      if (t->hists[i])
+        memset(t->hists[i], 0, sizeof(Prof_Hist));
+    }
+  }
+  pthread_mutex_unlock(&__prof_lock);
+}
+#else
+#define prof_add(name, n)
+#define prof_count(name)
+#define prof_record(name, v)
+#define prof_scope(name)
+#define prof_dump(fp)
+#define prof_reset()
+#endif // PJ_PROFILE
+
+#if defined(PJ_PROFILE) && defined(PJ_PROFILE_PROBES)
+#define __prof_probe(...) __VA_ARGS__
+#else
+#define __prof_probe(...)
+#endif // PJ_PROFILE_PROBES
+
+/* End: Profiling */
+
 /* Start: DYNAMIC ARRAY */
 
 /*
@@ -123,15 +422,11 @@ typedef struct {
 
 #define da_reserve(da, size)                                                   \
   do {                                                                         \
-    if ((da)->capacity < size) {                                               \
-      if ((da)->items) {                                                       \
-        (da)->items = realloc((da)->items, (size) * __item_size((da)));        \
-      } else {                                                                 \
-        (da)->items = malloc((size) * __item_size((da)));                      \
-      }                                                                        \
+    size_t __size = (size);                                                    \
+    if ((da)->capacity < __size) {                                             \
+      (da)->items = realloc((da)->items, __size * __item_size((da)));          \
       assert((da)->items);                                                     \
-      (da)->count = 0;                                                         \
-      (da)->capacity = (size);                                                 \
+      (da)->capacity = __size;                                                 \
     }                                                                          \
   } while (0);
 
@@ -146,24 +441,120 @@ typedef struct {
     }                                                                          \
   } while (0);
 
+/*
+   A growth policy returns the capacity to grow to when `needed` items don't
+   fit in `capacity`. DA_GROWTH is used unless a `_with` variant is given one,
+   define it before including libpj.h to change the default.
+*/
+typedef size_t (*da_growth_policy)(size_t capacity, size_t needed);
+
 #define __GROWTH_RATE 2
-#define da_grow(da)                                                            \
+static inline size_t da_growth_geometric(size_t capacity, size_t needed) {
+  size_t cap = MAX(capacity, 1);
+  while (cap < needed)
+    cap *= __GROWTH_RATE;
+  return cap;
+}
+
+static inline size_t da_growth_1_5(size_t capacity, size_t needed) {
+  size_t cap = MAX(capacity, 2);
+  while (cap < needed)
+    cap += cap / 2;
+  return cap;
+}
+
+static inline size_t da_growth_exact(size_t capacity, size_t needed) {
+  UNUSED(capacity);
+  return needed;
+}
+
+#ifndef DA_GROWTH
+#define DA_GROWTH da_growth_geometric
+#endif // DA_GROWTH
+
+/* Make room for `needed` items, the first allocation is at least __INIT_CAP */
+#define da_reserve_with(da, needed, policy)                                    \
   do {                                                                         \
-    (da)->items = realloc((da)->items,                                         \
-                          (da)->capacity * __GROWTH_RATE * __item_size((da))); \
-    assert((da)->items);                                                       \
-    (da)->capacity *= __GROWTH_RATE;                                           \
+    size_t __need = (needed);                                                  \
+    if (!(da)->items) {                                                        \
+      da_reserve((da), MAX(__need, (size_t)__INIT_CAP));                       \
+    } else if ((da)->capacity < __need) {                                      \
+      __prof_probe(prof_count("da_grow"));                                     \
+      da_reserve((da), (policy)((da)->capacity, __need));                      \
+    }                                                                          \
   } while (0);
 
-#define da_append(da, x)                                                       \
+#define da_grow(da)                                                            \
+  da_reserve((da), DA_GROWTH((da)->capacity, (da)->capacity + 1))
+
+#define da_append_with(da, x, policy)                                          \
   do {                                                                         \
-    da_init((da));                                                             \
     if ((da)->count == (da)->capacity) {                                       \
-      da_grow((da));                                                           \
+      da_reserve_with((da), (da)->count + 1, policy);                          \
     }                                                                          \
     (da)->items[(da)->count] = (x);                                            \
     (da)->count++;                                                             \
   } while (0);
+#define da_append(da, x) da_append_with((da), (x), DA_GROWTH)
+
+/* Append `n` items from `ptr`, which must not point into `da` */
+#define da_extend_with(da, ptr, n, policy)                                     \
+  do {                                                                         \
+    size_t __n = (n);                                                          \
+    da_reserve_with((da), (da)->count + __n, policy);                          \
+    memcpy((da)->items + (da)->count, (ptr), __n * __item_size((da)));         \
+    (da)->count += __n;                                                        \
+  } while (0);
+#define da_extend(da, ptr, n) da_extend_with((da), (ptr), (n), DA_GROWTH)
+
+/* Insert `n` items from `ptr` before index `i` */
+#define da_insert_n_with(da, i, ptr, n, policy)                                \
+  do {                                                                         \
+    size_t __at = (i), __n = (n);                                              \
+    assert(__at <= (da)->count);                                               \
+    da_reserve_with((da), (da)->count + __n, policy);                          \
+    memmove((da)->items + __at + __n, (da)->items + __at,                      \
+            ((da)->count - __at) * __item_size((da)));                         \
+    memcpy((da)->items + __at, (ptr), __n * __item_size((da)));                \
+    (da)->count += __n;                                                        \
+  } while (0);
+#define da_insert_n(da, i, ptr, n)                                             \
+  da_insert_n_with((da), (i), (ptr), (n), DA_GROWTH)
+
+/* Remove the `n` items starting at index `i` */
+#define da_remove_range(da, i, n)                                              \
+  do {                                                                         \
+    size_t __at = (i), __n = (n);                                              \
+    assert(__at + __n <= (da)->count);                                         \
+    memmove((da)->items + __at, (da)->items + __at + __n,                      \
+            ((da)->count - __at - __n) * __item_size((da)));                   \
+    (da)->count -= __n;                                                        \
+  } while (0);
+
+/* Set count to `n`, new items are set to `fill` */
+#define da_resize_with(da, n, fill, policy)                                    \
+  do {                                                                         \
+    size_t __n = (n);                                                          \
+    da_reserve_with((da), __n, policy);                                        \
+    for (size_t __j = (da)->count; __j < __n; ++__j) {                         \
+      (da)->items[__j] = (fill);                                               \
+    }                                                                          \
+    (da)->count = __n;                                                         \
+  } while (0);
+#define da_resize(da, n, fill) da_resize_with((da), (n), (fill), DA_GROWTH)
+
+#define da_shrink_to_fit(da)                                                   \
+  do {                                                                         \
+    if ((da)->count == 0) {                                                    \
+      free((da)->items);                                                       \
+      (da)->items = NULL;                                                      \
+      (da)->capacity = 0;                                                      \
+    } else if ((da)->count < (da)->capacity) {                                 \
+      (da)->items = realloc((da)->items, (da)->count * __item_size((da)));     \
+      assert((da)->items);                                                     \
+      (da)->capacity = (da)->count;                                            \
+    }                                                                          \
+  } while (0);
 
 #define da_map(da, f)                                                          \
   do {                                                                         \
@@ -175,154 +566,1708 @@ typedef struct {
 
 #define da_pop(da) ((da)->items[--(da)->count])
 
+/*
+   da_soa_decl(name, (type, field)...) declares a struct-of-arrays container:
+   one contiguous column per field plus a shared count and capacity.
+   ```
+   da_soa_decl(Points, (float, x), (float, y))
+   // typedef struct { float *x, *y; size_t count, capacity; } Points;
+   // typedef struct { float x; float y; } Points_row;
+   ```
+   Each column is accessed directly, e.g. `points.x[i]`, and the rows through:
+   ```
+   void name_reserve(name *s, size_t n);
+   void name_append(name *s, name_row r);
+   name_row name_get(name *s, size_t i);
+   void name_set(name *s, size_t i, name_row r);
+   void name_free(name *s);
+   ```
+*/
+#define __soa_column(t) __soa_column_ t
+#define __soa_column_(type, field) type *field;
+#define __soa_member(t) __soa_member_ t
+#define __soa_member_(type, field) type field;
+#define __soa_realloc(t) __soa_realloc_ t
+#define __soa_realloc_(type, field)                                            \
+  s->field = realloc(s->field, n * sizeof(type));                              \
+  assert(s->field);
+#define __soa_store(t) __soa_store_ t
+#define __soa_store_(type, field) s->field[i] = r.field;
+#define __soa_load(t) __soa_load_ t
+#define __soa_load_(type, field) r.field = s->field[i];
+#define __soa_free(t) __soa_free_ t
+#define __soa_free_(type, field) free(s->field);
+
+#define da_soa_decl(name, ...)                                                 \
+  typedef struct {                                                             \
+    __PP_MAP(__soa_column, __VA_ARGS__)                                        \
+    size_t count;                                                              \
+    size_t capacity;                                                           \
+  } name;                                                                      \
+                                                                               \
+  typedef struct {                                                             \
+    __PP_MAP(__soa_member, __VA_ARGS__)                                        \
+  } name##_row;                                                                \
+                                                                               \
+  static inline void name##_reserve(name *s, size_t n) {                       \
+    if (s->capacity >= n)                                                      \
+      return;                                                                  \
+    __PP_MAP(__soa_realloc, __VA_ARGS__)                                       \
+    s->capacity = n;                                                           \
+  }                                                                            \
+                                                                               \
+  static inline void name##_set(name *s, size_t i, name##_row r) {             \
+    __PP_MAP(__soa_store, __VA_ARGS__)                                         \
+  }                                                                            \
+                                                                               \
+  static inline name##_row name##_get(name *s, size_t i) {                     \
+    name##_row r;                                                              \
+    __PP_MAP(__soa_load, __VA_ARGS__)                                          \
+    return r;                                                                  \
+  }                                                                            \
+                                                                               \
+  static inline void name##_append(name *s, name##_row r) {                    \
+    if (s->count == s->capacity) {                                             \
+      name##_reserve(s, s->capacity ? DA_GROWTH(s->capacity, s->count + 1)     \
+                                    : __INIT_CAP);                             \
+    }                                                                          \
+    name##_set(s, s->count++, r);                                              \
+  }                                                                            \
+                                                                               \
+  static inline void name##_free(name *s) {                                    \
+    __PP_MAP(__soa_free, __VA_ARGS__)                                          \
+    *s = (name){0};                                                            \
+  }
+
+#define da_soa_foreach(name, s, row)                                           \
+  for (size_t __i = 0; __i < (s)->count && ((row = name##_get((s), __i)), 1);  \
+       ++__i)
+
 /* End: DYNAMIC ARRAY */
 
-/* Start: Box */
-#define Box(x)                                                                 \
-  _Generic((x), char *: __box_str, default: __box)(&x, sizeof((x)));
-static inline void *__box(void *x, size_t s) {
-  void *p = malloc(s);
-  memcpy(p, x, s);
-  return p;
+/* Start: Bitset */
+/*
+   A Bitset is a dynamic array of 64-bit words:
+   ```
+   typedef struct {
+       u64 *items;
+       size_t count;    // words in use
+       size_t capacity;
+   } Bitset;
+   ```
+
+   Bit `i` lives in items[i / 64] at position i % 64. bs_set grows the array,
+   every other operation treats bits past the end as cleared.
+*/
+typedef struct {
+  u64 *items;
+  size_t count;
+  size_t capacity;
+} Bitset;
+
+#define __BS_WORD(i) ((i) >> 6)
+#define __BS_BIT(i) ((i) & 63)
+#define BS_NONE ((size_t)-1)
+
+static inline void __bs_fit(Bitset *bs, size_t nwords) {
+  if (bs->count < nwords) {
+    da_resize(bs, nwords, 0);
+  }
 }
 
-static inline char *__box_str(void *x, size_t s) {
-  UNUSED(s);
-  char *str = *(char **)x;
-  return strdup(str);
+static inline void bs_set(Bitset *bs, size_t i) {
+  __bs_fit(bs, __BS_WORD(i) + 1);
+  SETBIT(bs->items[__BS_WORD(i)], __BS_BIT(i));
 }
 
-/* End: Box */
+static inline void bs_clear(Bitset *bs, size_t i) {
+  if (__BS_WORD(i) < bs->count) {
+    CLRBIT(bs->items[__BS_WORD(i)], __BS_BIT(i));
+  }
+}
 
-/* Start: Linear Algebra */
-/*
-   A Matrix has the shape:
-   struct {
-     <type> *items;
-     size_t nx;
-     size_t ny;
-   };
+static inline bool bs_test(const Bitset *bs, size_t i) {
+  return __BS_WORD(i) < bs->count &&
+         IS_SET(bs->items[__BS_WORD(i)], __BS_BIT(i));
+}
 
-   A Vector has shape:
-   struct {
-     <type> *items;
-     size_t n;
-   };
-*/
-#define ma_size(ma) ((ma)->nx * (ma)->ny * sizeof((ma)->items[0]))
+static inline size_t bs_popcount(const Bitset *bs) {
+  size_t n = 0;
+  for (size_t i = 0; i < bs->count; ++i) {
+    n += __builtin_popcountll(bs->items[i]);
+  }
+  return n;
+}
 
-#define ma_init(ma)                                                            \
-  do {                                                                         \
-    if (!(ma)->items) {                                                        \
-      (ma)->items = malloc(ma_size((ma)));                                     \
-    }                                                                          \
-    expect((ma)->items != NULL);                                       \
-  } while (0);
+/* Number of set bits in [0, i) */
+static inline size_t bs_rank(const Bitset *bs, size_t i) {
+  size_t n = 0, w = MIN(__BS_WORD(i), bs->count);
+  for (size_t j = 0; j < w; ++j) {
+    n += __builtin_popcountll(bs->items[j]);
+  }
+  if (w < bs->count && __BS_BIT(i)) {
+    n += __builtin_popcountll(bs->items[w] & ((1llu << __BS_BIT(i)) - 1));
+  }
+  return n;
+}
 
-/* Returns pointer to element */
-#define ma_at(ma, x, y) ((ma)->items + (ma)->nx * y + x)
+/* Index of the k-th (0-based) set bit, BS_NONE if there are not enough */
+static inline size_t bs_select(const Bitset *bs, size_t k) {
+  for (size_t j = 0; j < bs->count; ++j) {
+    u64 w = bs->items[j];
+    size_t c = __builtin_popcountll(w);
+    if (k < c) {
+#ifdef __BMI2__
+      w = _pdep_u64(1llu << k, w);
+#else
+      while (k--) {
+        w &= w - 1; /* Drop lowest set bit */
+      }
+#endif // __BMI2__
+      return j * 64 + __builtin_ctzll(w);
+    }
+    k -= c;
+  }
+  return BS_NONE;
+}
 
-#define ma_diag(ma, val)                                                       \
+/* Index of the first set bit >= i, BS_NONE if there is none */
+static inline size_t bs_next(const Bitset *bs, size_t i) {
+  size_t j = __BS_WORD(i);
+  if (i == BS_NONE || j >= bs->count)
+    return BS_NONE;
+
+  u64 w = bs->items[j] & (~0llu << __BS_BIT(i));
+  while (!w) {
+    if (++j == bs->count)
+      return BS_NONE;
+    w = bs->items[j];
+  }
+  return j * 64 + __builtin_ctzll(w);
+}
+
+#define bs_foreach(bs, i)                                                      \
+  for (size_t __b = bs_next((bs), 0); __b != BS_NONE && ((i = __b) || 1);      \
+       __b = bs_next((bs), __b + 1))
+
+/* `a` is the destination word(s), `b` the source word(s) */
+#ifdef __AVX2__
+#define __bs_loop(dst, src, n, op, vop)                                        \
   do {                                                                         \
-    expect((ma)->nx == (ma)->ny);                                              \
-    ma_fill((ma), 0);                                                          \
-    for (size_t __i = 0; __i < (ma)->nx; ++__i) {                              \
-      *ma_at((ma), __i, __i) = val;                                            \
+    size_t __j = 0;                                                            \
+    for (; __j + 4 <= (n); __j += 4) {                                         \
+      __m256i a = _mm256_loadu_si256((const __m256i *)((dst) + __j));          \
+      __m256i b = _mm256_loadu_si256((const __m256i *)((src) + __j));          \
+      _mm256_storeu_si256((__m256i *)((dst) + __j), vop);                      \
+    }                                                                          \
+    for (; __j < (n); ++__j) {                                                 \
+      u64 a = (dst)[__j], b = (src)[__j];                                      \
+      (dst)[__j] = op;                                                         \
     }                                                                          \
   } while (0);
-
-#define ma_fill(ma, val)                                                       \
+#else
+#define __bs_loop(dst, src, n, op, vop)                                        \
   do {                                                                         \
-    ma_init((ma));                                                             \
-    memset((ma)->items, val, ma_size((ma)));                                   \
+    for (size_t __j = 0; __j < (n); ++__j) {                                   \
+      u64 a = (dst)[__j], b = (src)[__j];                                      \
+      (dst)[__j] = op;                                                         \
+    }                                                                          \
   } while (0);
+#endif // __AVX2__
 
-#define ma_zero(ma) ma_fill((ma), 0)
+static inline void bs_or(Bitset *dst, const Bitset *src) {
+  __bs_fit(dst, src->count);
+  __bs_loop(dst->items, src->items, src->count, a | b, _mm256_or_si256(a, b));
+}
 
-#define ma_inbounds(ma, x, y)                                                  \
-  ((0 <= (x) && (x) < (typeof((x)))(ma)->nx) &&                                \
-   (0 <= (y) && (y) < (typeof((y)))(ma)->ny))
+static inline void bs_xor(Bitset *dst, const Bitset *src) {
+  __bs_fit(dst, src->count);
+  __bs_loop(dst->items, src->items, src->count, a ^ b, _mm256_xor_si256(a, b));
+}
 
-#define v_size(v) ((v)->n * sizeof((v)->items[0]))
-#define v_init(v)                                                              \
-  do {                                                                         \
-    if (!(v)->items) {                                                         \
-      (v)->items = malloc(v_size(v));                                          \
-    }                                                                          \
-  } while (0);
+static inline void bs_and(Bitset *dst, const Bitset *src) {
+  size_t n = MIN(dst->count, src->count);
+  __bs_loop(dst->items, src->items, n, a & b, _mm256_and_si256(a, b));
+  if (dst->count > n) {
+    memset(dst->items + n, 0, (dst->count - n) * sizeof(u64));
+  }
+}
 
-#define v_fill(v, val)                                                         \
-  do {                                                                         \
-    memset((v)->items, val, v_size((v)));                                      \
-  } while (0);
+/* dst &= ~src */
+static inline void bs_andnot(Bitset *dst, const Bitset *src) {
+  size_t n = MIN(dst->count, src->count);
+  __bs_loop(dst->items, src->items, n, a & ~b, _mm256_andnot_si256(b, a));
+}
 
-#define ma_mul(ma1, ma2) TODO()
-#define ma_mulv(ma, v) TODO()
+static inline void bs_reset(Bitset *bs) {
+  if (bs->count) {
+    memset(bs->items, 0, bs->count * sizeof(u64));
+  }
+}
 
-typedef struct {
-  ssize_t x, y;
-} Vector2;
+static inline void bs_free(Bitset *bs) {
+  free(bs->items);
+  *bs = (Bitset){0};
+}
 
-typedef struct {
-  ssize_t x, y, z;
-} Vector3;
+/*
+   A Roaring bitmap is a compressed set of u32 for sparse data. Values are
+   bucketed by their high 16 bits into containers kept sorted by key. A
+   container stores the low 16 bits either as a sorted u16 array or, once it
+   holds more than __RB_ARRAY_MAX values, as a 65536-bit bitmap.
+*/
+#define __RB_ARRAY_MAX 4096
+#define __RB_BITMAP_WORDS (65536 / 64)
 
 typedef struct {
-  float x, y;
-} Vector2f;
-
-/* End: Linear Algebra */
-
-/* Start: STRING BUILDER */
+  u16 *items;  /* Sorted values when bitmap == NULL */
+  size_t count; /* Cardinality of the container */
+  size_t capacity;
+  u64 *bitmap;
+  u16 key;
+} __rb_container;
 
-/* A string builder is like a dynamic array specialized on strings */
 typedef struct {
-  char *items;
+  __rb_container *items;
   size_t count;
   size_t capacity;
-} String_Builder;
-
-#define sb_append(sb, str)                                                     \
-  do {                                                                         \
-    size_t __l = strlen(str);                                                  \
-    if ((sb)->count == 0)                                                      \
-      da_append(sb, '\0');                                                     \
-    (sb)->count--;                                                             \
-    for (size_t __i = 0; __i < __l; ++__i) {                                   \
-      da_append((sb), str[__i]);                                               \
-    }                                                                          \
-    da_append((sb), '\0');                                                     \
-  } while (0);
-
-#define sb_skip_word(sb)                                                       \
-  do {                                                                         \
-    while (*(sb)->items && isalnum(*(sb)->items)) {                            \
-      (sb)->items++;                                                           \
-      (sb)->count--;                                                           \
-    }                                                                          \
-    while (*(sb)->items && isspace(*(sb)->items)) {                            \
-      (sb)->items++;                                                           \
-      (sb)->count--;                                                           \
-    }                                                                          \
-  } while (0);
-
-static inline char *sb_get_words(String_Builder *sb, int n) {
-  char *tmp = sb->items;
-  while (n--) {
-    sb_skip_word(sb);
+} Roaring;
+
+/* Index of the first element >= x in a sorted array of n u16 */
+static inline size_t __rb_lower_bound(const u16 *a, size_t n, u16 x) {
+  size_t lo = 0, hi = n;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (a[mid] < x)
+      lo = mid + 1;
+    else
+      hi = mid;
   }
-  return strndup(tmp, sb->items - tmp - 1);
+  return lo;
 }
 
-#define sb_appends(sb, ...) __sb_appends((sb), __VA_ARGS__, NULL)
-static inline void __sb_appends(String_Builder *sb, ...) {
-  char *s;
-  va_list ap;
-  va_start(ap, sb);
-  s = va_arg(ap, char *);
-  while (s) {
-    sb_append(sb, s);
-    s = va_arg(ap, char *);
+/* Index of the first container with key >= k */
+static inline size_t __rb_find(const Roaring *rb, u16 k) {
+  size_t lo = 0, hi = rb->count;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (rb->items[mid].key < k)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+static inline void __rb_to_bitmap(__rb_container *c) {
+  c->bitmap = calloc(__RB_BITMAP_WORDS, sizeof(u64));
+  assert(c->bitmap);
+  for (size_t i = 0; i < c->count; ++i) {
+    SETBIT(c->bitmap[__BS_WORD(c->items[i])], __BS_BIT(c->items[i]));
+  }
+  free(c->items);
+  c->items = NULL;
+  c->capacity = 0;
+}
+
+static inline void __rb_to_array(__rb_container *c) {
+  size_t n = c->count;
+  c->count = 0;
+  for (size_t j = 0; j < __RB_BITMAP_WORDS; ++j) {
+    for (u64 w = c->bitmap[j]; w; w &= w - 1) {
+      da_append(c, (u16)(j * 64 + __builtin_ctzll(w)));
+    }
+  }
+  assert(c->count == n);
+  free(c->bitmap);
+  c->bitmap = NULL;
+}
+
+static inline void rb_add(Roaring *rb, u32 x) {
+  u16 k = x >> 16, lo = x & 0xffff;
+  size_t i = __rb_find(rb, k);
+  if (i == rb->count || rb->items[i].key != k) {
+    __rb_container c = {.key = k};
+    da_insert_n(rb, i, &c, 1);
+  }
+
+  __rb_container *c = &rb->items[i];
+  if (c->bitmap) {
+    if (!IS_SET(c->bitmap[__BS_WORD(lo)], __BS_BIT(lo))) {
+      SETBIT(c->bitmap[__BS_WORD(lo)], __BS_BIT(lo));
+      c->count++;
+    }
+    return;
+  }
+
+  size_t j = __rb_lower_bound(c->items, c->count, lo);
+  if (j < c->count && c->items[j] == lo)
+    return;
+
+  if (c->count == __RB_ARRAY_MAX) {
+    __rb_to_bitmap(c);
+    SETBIT(c->bitmap[__BS_WORD(lo)], __BS_BIT(lo));
+    c->count++;
+    return;
+  }
+
+  da_insert_n(c, j, &lo, 1);
+}
+
+static inline bool rb_contains(const Roaring *rb, u32 x) {
+  u16 k = x >> 16, lo = x & 0xffff;
+  size_t i = __rb_find(rb, k);
+  if (i == rb->count || rb->items[i].key != k)
+    return false;
+
+  const __rb_container *c = &rb->items[i];
+  if (c->bitmap)
+    return IS_SET(c->bitmap[__BS_WORD(lo)], __BS_BIT(lo));
+
+  size_t j = __rb_lower_bound(c->items, c->count, lo);
+  return j < c->count && c->items[j] == lo;
+}
+
+static inline void rb_remove(Roaring *rb, u32 x) {
+  u16 k = x >> 16, lo = x & 0xffff;
+  size_t i = __rb_find(rb, k);
+  if (i == rb->count || rb->items[i].key != k)
+    return;
+
+  __rb_container *c = &rb->items[i];
+  if (c->bitmap) {
+    if (!IS_SET(c->bitmap[__BS_WORD(lo)], __BS_BIT(lo)))
+      return;
+    CLRBIT(c->bitmap[__BS_WORD(lo)], __BS_BIT(lo));
+    if (--c->count == __RB_ARRAY_MAX) {
+      __rb_to_array(c);
+    }
+    return;
+  }
+
+  size_t j = __rb_lower_bound(c->items, c->count, lo);
+  if (j == c->count || c->items[j] != lo)
+    return;
+  da_remove_range(c, j, 1);
+  if (c->count == 0) {
+    free(c->items);
+    da_remove_range(rb, i, 1);
+  }
+}
+
+static inline size_t rb_cardinality(const Roaring *rb) {
+  size_t n = 0;
+  for (size_t i = 0; i < rb->count; ++i) {
+    n += rb->items[i].count;
+  }
+  return n;
+}
+
+/* First value >= x, UINT64_MAX if there is none */
+static inline u64 rb_next(const Roaring *rb, u64 x) {
+  if (x > UINT32_MAX)
+    return UINT64_MAX;
+
+  for (size_t i = __rb_find(rb, x >> 16); i < rb->count; ++i) {
+    const __rb_container *c = &rb->items[i];
+    u16 lo = c->key == (x >> 16) ? x & 0xffff : 0;
+    u64 base = (u64)c->key << 16;
+
+    if (c->bitmap) {
+      size_t j = __BS_WORD(lo);
+      u64 w = c->bitmap[j] & (~0llu << __BS_BIT(lo));
+      while (!w && ++j < __RB_BITMAP_WORDS) {
+        w = c->bitmap[j];
+      }
+      if (w)
+        return base + j * 64 + __builtin_ctzll(w);
+    } else {
+      size_t j = __rb_lower_bound(c->items, c->count, lo);
+      if (j < c->count)
+        return base + c->items[j];
+    }
+  }
+  return UINT64_MAX;
+}
+
+#define rb_foreach(rb, x)                                                      \
+  for (u64 __r = rb_next((rb), 0); __r != UINT64_MAX && ((x = __r) || 1);      \
+       __r = rb_next((rb), __r + 1))
+
+static inline void rb_to_bitset(const Roaring *rb, Bitset *bs) {
+  for (size_t i = 0; i < rb->count; ++i) {
+    const __rb_container *c = &rb->items[i];
+    size_t base = (size_t)c->key << 16;
+    if (c->bitmap) {
+      __bs_fit(bs, __BS_WORD(base) + __RB_BITMAP_WORDS);
+      for (size_t j = 0; j < __RB_BITMAP_WORDS; ++j) {
+        bs->items[__BS_WORD(base) + j] |= c->bitmap[j];
+      }
+    } else {
+      for (size_t j = 0; j < c->count; ++j) {
+        bs_set(bs, base + c->items[j]);
+      }
+    }
+  }
+}
+
+static inline void rb_free(Roaring *rb) {
+  for (size_t i = 0; i < rb->count; ++i) {
+    free(rb->items[i].items);
+    free(rb->items[i].bitmap);
+  }
+  free(rb->items);
+  *rb = (Roaring){0};
+}
+
+/* End: Bitset */
+
+/* Start: Heap */
+/*
+   heap_decl(name, type, less) declares a binary min-heap `name` with the
+   dynamic array layout, so the da_* macros work on it, and generates:
+   ```
+   void name_push(name *h, type x);
+   type name_peek(name *h);
+   type name_pop(name *h);
+   void name_heapify(name *h);   // Restore the heap order of h->items
+   void name_free(name *h);
+   ```
+   `less(a, b)` orders two values, the smallest one is on top. heap_decl_d
+   takes the arity of the tree instead, 4 keeps the children of a node on one
+   cache line for small types.
+
+   heap_decl_indexed additionally keeps `pos`, a map from `id(x)` (a small
+   dense integer) to the index of x in items, which enables:
+   ```
+   bool name_contains(name *h, size_t id);
+   void name_decrease_key(name *h, type x); // Push x, or replace the queued
+                                            // element with its id (a larger
+                                            // key moves it down instead)
+   ```
+*/
+#define HEAP_NO_ID ((size_t)-1)
+#define __heap_no_id(x) HEAP_NO_ID
+
+#define heap_decl(name, type, less)                                            \
+  __heap_decl(name, type, less, 2, __heap_no_id)
+#define heap_decl_d(name, type, less, arity)                                   \
+  __heap_decl(name, type, less, arity, __heap_no_id)
+#define heap_decl_indexed(name, type, less, arity, id)                         \
+  __heap_decl(name, type, less, arity, id)
+
+#define __heap_decl(name, type, less, arity, id)                               \
+  typedef struct {                                                             \
+    type *items;                                                               \
+    size_t count;                                                              \
+    size_t capacity;                                                           \
+    size_t *pos;                                                               \
+    size_t npos;                                                               \
+  } name;                                                                      \
+                                                                               \
+  static inline void name##_place(name *h, size_t i, type x) {                 \
+    h->items[i] = x;                                                           \
+    size_t __id = id(x);                                                       \
+    if (__id == HEAP_NO_ID)                                                    \
+      return;                                                                  \
+    if (__id >= h->npos) {                                                     \
+      size_t __n = MAX(__id + 1, 2 * h->npos);                                 \
+      h->pos = realloc(h->pos, __n * sizeof(size_t));                          \
+      assert(h->pos);                                                          \
+      for (size_t __j = h->npos; __j < __n; ++__j) {                           \
+        h->pos[__j] = HEAP_NO_ID;                                              \
+      }                                                                        \
+      h->npos = __n;                                                           \
+    }                                                                          \
+    h->pos[__id] = i;                                                          \
+  }                                                                            \
+                                                                               \
+  static inline void name##_sift_up(name *h, size_t i) {                       \
+    type x = h->items[i];                                                      \
+    while (i > 0) {                                                            \
+      size_t p = (i - 1) / (arity);                                            \
+      if (!less(x, h->items[p]))                                               \
+        break;                                                                 \
+      name##_place(h, i, h->items[p]);                                         \
+      i = p;                                                                   \
+    }                                                                          \
+    name##_place(h, i, x);                                                     \
+  }                                                                            \
+                                                                               \
+  static inline void name##_sift_down(name *h, size_t i) {                     \
+    type x = h->items[i];                                                      \
+    for (;;) {                                                                 \
+      size_t c = (arity) * i + 1, best = c;                                    \
+      if (c >= h->count)                                                       \
+        break;                                                                 \
+      for (size_t k = 1; k < (arity) && c + k < h->count; ++k) {               \
+        if (less(h->items[c + k], h->items[best]))                             \
+          best = c + k;                                                        \
+      }                                                                        \
+      if (!less(h->items[best], x))                                            \
+        break;                                                                 \
+      name##_place(h, i, h->items[best]);                                      \
+      i = best;                                                                \
+    }                                                                          \
+    name##_place(h, i, x);                                                     \
+  }                                                                            \
+                                                                               \
+  static inline void name##_push(name *h, type x) {                            \
+    da_append(h, x);                                                           \
+    name##_sift_up(h, h->count - 1);                                           \
+  }                                                                            \
+                                                                               \
+  static inline type name##_peek(name *h) {                                    \
+    assert(h->count && "Empty heap");                                          \
+    return h->items[0];                                                        \
+  }                                                                            \
+                                                                               \
+  static inline type name##_pop(name *h) {                                     \
+    assert(h->count && "Empty heap");                                          \
+    type top = h->items[0];                                                    \
+    size_t __id = id(top);                                                     \
+    if (__id != HEAP_NO_ID)                                                    \
+      h->pos[__id] = HEAP_NO_ID;                                               \
+    type last = da_pop(h);                                                     \
+    if (h->count) {                                                            \
+      h->items[0] = last;                                                      \
+      name##_sift_down(h, 0);                                                  \
+    }                                                                          \
+    return top;                                                                \
+  }                                                                            \
+                                                                               \
+  static inline void name##_heapify(name *h) {                                 \
+    for (size_t i = 0; i < h->count; ++i) {                                    \
+      name##_place(h, i, h->items[i]);                                         \
+    }                                                                          \
+    for (size_t i = h->count / (arity) + 1; i-- > 0;) {                        \
+      name##_sift_down(h, i);                                                  \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  static inline bool name##_contains(name *h, size_t __id) {                   \
+    return __id < h->npos && h->pos[__id] != HEAP_NO_ID;                       \
+  }                                                                            \
+                                                                               \
+  static inline void name##_decrease_key(name *h, type x) {                    \
+    size_t __id = id(x);                                                       \
+    assert(__id != HEAP_NO_ID && "decrease_key needs heap_decl_indexed");      \
+    if (!name##_contains(h, __id)) {                                           \
+      name##_push(h, x);                                                       \
+      return;                                                                  \
+    }                                                                          \
+    size_t __i = h->pos[__id];                                                 \
+    bool __up = !less(h->items[__i], x);                                       \
+    h->items[__i] = x;                                                         \
+    if (__up) {                                                                \
+      name##_sift_up(h, __i);                                                  \
+    } else {                                                                   \
+      name##_sift_down(h, __i);                                                \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  static inline void name##_free(name *h) {                                    \
+    free(h->items);                                                            \
+    free(h->pos);                                                              \
+    *h = (name){0};                                                            \
+  }
+
+/* End: Heap */
+
+/* Start: B-Tree */
+/*
+   btree_decl(name, K, V, less) declares an ordered map `name` from K to V,
+   a B+-tree whose leaves are chained in key order, and generates:
+   ```
+   V   *name_find(const name *t, K key);   // NULL if key is absent
+   bool name_insert(name *t, K key, V value); // false if key was replaced
+   bool name_erase(name *t, K key);        // false if key was absent
+   name_iter name_lower_bound(const name *t, K key); // First key >= key
+   name_iter name_upper_bound(const name *t, K key); // First key > key
+   name_iter name_begin(const name *t);
+   void name_next(name_iter *it);
+   void name_load(name *t, const name_entry *e, size_t n);
+   void name_free(name *t);
+   ```
+   An iterator past the last key has it.node == NULL, btree_key and
+   btree_value access the entry it points at. name_load replaces the contents
+   of t with n entries sorted by strictly increasing key, packing the leaves
+   instead of inserting them one by one; btree_load_da does the same from a
+   dynamic array of name_entry.
+
+   Nodes hold up to BTREE_ORDER keys (even, at least 4), the default keeps a
+   node of 8 byte keys within a few cache lines.
+*/
+#ifndef BTREE_ORDER
+#define BTREE_ORDER 32
+#endif // BTREE_ORDER
+#define __BTREE_MIN (BTREE_ORDER / 2)
+
+#define btree_key(it) ((it).node->keys[(it).i])
+#define btree_value(it) ((it).node->vals[(it).i])
+
+/* Visit keys in [lo, hi] in order, nothing if hi < lo */
+#define btree_foreach_range(name, t, lo, hi, it)                               \
+  for (name##_iter __end, it = name##__range((t), (lo), (hi), &__end);         \
+       it.node != __end.node || it.i != __end.i; name##_next(&it))
+#define btree_foreach(name, t, it)                                             \
+  for (name##_iter it = name##_begin((t)); it.node; name##_next(&it))
+
+#define btree_load_da(name, t, da) name##_load((t), (da)->items, (da)->count)
+
+#define btree_decl(name, K, V, less)                                           \
+  typedef struct name##_node {                                                 \
+    size_t count;                                                              \
+    bool leaf;                                                                 \
+    K keys[BTREE_ORDER + 1];                                                   \
+    union {                                                                    \
+      V vals[BTREE_ORDER + 1];                                                 \
+      struct name##_node *kids[BTREE_ORDER + 2];                               \
+    };                                                                         \
+    struct name##_node *next;                                                  \
+  } name##_node;                                                               \
+                                                                               \
+  typedef struct {                                                             \
+    name##_node *root;                                                         \
+    size_t count;                                                              \
+  } name;                                                                      \
+                                                                               \
+  typedef struct {                                                             \
+    name##_node *node;                                                         \
+    size_t i;                                                                  \
+  } name##_iter;                                                               \
+                                                                               \
+  typedef struct {                                                             \
+    K key;                                                                     \
+    V value;                                                                   \
+  } name##_entry;                                                              \
+                                                                               \
+  /* First index whose key is >= k, or > k */                                  \
+  static inline size_t name##__lower(const name##_node *n, K k) {              \
+    size_t lo = 0, hi = n->count;                                              \
+    while (lo < hi) {                                                          \
+      size_t mid = (lo + hi) / 2;                                              \
+      if (less(n->keys[mid], k))                                               \
+        lo = mid + 1;                                                          \
+      else                                                                     \
+        hi = mid;                                                              \
+    }                                                                          \
+    return lo;                                                                 \
+  }                                                                            \
+  static inline size_t name##__upper(const name##_node *n, K k) {              \
+    size_t lo = 0, hi = n->count;                                              \
+    while (lo < hi) {                                                          \
+      size_t mid = (lo + hi) / 2;                                              \
+      if (less(k, n->keys[mid]))                                               \
+        hi = mid;                                                              \
+      else                                                                     \
+        lo = mid + 1;                                                          \
+    }                                                                          \
+    return lo;                                                                 \
+  }                                                                            \
+                                                                               \
+  static inline name##_node *name##__leaf(const name *t, K k) {                \
+    name##_node *n = t->root;                                                  \
+    while (n && !n->leaf)                                                      \
+      n = n->kids[name##__upper(n, k)];                                        \
+    return n;                                                                  \
+  }                                                                            \
+                                                                               \
+  static inline V *name##_find(const name *t, K key) {                         \
+    name##_node *n = name##__leaf(t, key);                                     \
+    if (n == NULL)                                                             \
+      return NULL;                                                             \
+    size_t i = name##__lower(n, key);                                          \
+    if (i == n->count || less(key, n->keys[i]))                                \
+      return NULL;                                                             \
+    return &n->vals[i];                                                        \
+  }                                                                            \
+                                                                               \
+  static inline name##_iter name##__at(name##_node *n, size_t i) {             \
+    if (n && i == n->count) {                                                  \
+      n = n->next;                                                             \
+      i = 0;                                                                   \
+    }                                                                          \
+    return (name##_iter){n, i};                                                \
+  }                                                                            \
+  static inline name##_iter name##_lower_bound(const name *t, K key) {         \
+    name##_node *n = name##__leaf(t, key);                                     \
+    return name##__at(n, n ? name##__lower(n, key) : 0);                       \
+  }                                                                            \
+  static inline name##_iter name##_upper_bound(const name *t, K key) {         \
+    name##_node *n = name##__leaf(t, key);                                     \
+    return name##__at(n, n ? name##__upper(n, key) : 0);                       \
+  }                                                                            \
+  static inline name##_iter name##_begin(const name *t) {                      \
+    name##_node *n = t->root;                                                  \
+    while (n && !n->leaf)                                                      \
+      n = n->kids[0];                                                          \
+    return (name##_iter){n && n->count ? n : NULL, 0};                         \
+  }                                                                            \
+  static inline void name##_next(name##_iter *it) {                            \
+    *it = name##__at(it->node, it->i + 1);                                     \
+  }                                                                            \
+  static inline name##_iter name##__range(const name *t, K lo, K hi,           \
+                                          name##_iter *end) {                  \
+    *end = name##_upper_bound(t, hi);                                          \
+    return less(hi, lo) ? *end : name##_lower_bound(t, lo);                    \
+  }                                                                            \
+                                                                               \
+  static inline name##_node *name##__node(bool leaf) {                         \
+    name##_node *n = calloc(1, sizeof(*n));                                    \
+    assert(n);                                                                 \
+    n->leaf = leaf;                                                            \
+    return n;                                                                  \
+  }                                                                            \
+                                                                               \
+  /* Insert into the subtree at n, returns the new right sibling if n split */ \
+  static inline name##_node *name##__insert(name *t, name##_node *n, K k, V v, \
+                                           K *sep) {                           \
+    if (n->leaf) {                                                             \
+      size_t i = name##__lower(n, k);                                          \
+      if (i < n->count && !less(k, n->keys[i])) {                              \
+        n->vals[i] = v;                                                        \
+        return NULL;                                                           \
+      }                                                                        \
+      memmove(&n->keys[i + 1], &n->keys[i], (n->count - i) * sizeof(K));       \
+      memmove(&n->vals[i + 1], &n->vals[i], (n->count - i) * sizeof(V));       \
+      n->keys[i] = k;                                                          \
+      n->vals[i] = v;                                                          \
+      n->count++;                                                              \
+      t->count++;                                                              \
+      if (n->count <= BTREE_ORDER)                                             \
+        return NULL;                                                           \
+      name##_node *r = name##__node(true);                                     \
+      size_t half = n->count / 2;                                              \
+      r->count = n->count - half;                                              \
+      memcpy(r->keys, &n->keys[half], r->count * sizeof(K));                   \
+      memcpy(r->vals, &n->vals[half], r->count * sizeof(V));                   \
+      n->count = half;                                                         \
+      r->next = n->next;                                                       \
+      n->next = r;                                                             \
+      *sep = r->keys[0];                                                       \
+      return r;                                                                \
+    }                                                                          \
+    size_t i = name##__upper(n, k);                                            \
+    K up;                                                                      \
+    name##_node *split = name##__insert(t, n->kids[i], k, v, &up);             \
+    if (split == NULL)                                                         \
+      return NULL;                                                             \
+    memmove(&n->keys[i + 1], &n->keys[i], (n->count - i) * sizeof(K));         \
+    memmove(&n->kids[i + 2], &n->kids[i + 1],                                  \
+            (n->count - i) * sizeof(void *));                                  \
+    n->keys[i] = up;                                                           \
+    n->kids[i + 1] = split;                                                    \
+    n->count++;                                                                \
+    if (n->count <= BTREE_ORDER)                                               \
+      return NULL;                                                             \
+    name##_node *r = name##__node(false);                                      \
+    size_t mid = n->count / 2;                                                 \
+    r->count = n->count - mid - 1;                                             \
+    memcpy(r->keys, &n->keys[mid + 1], r->count * sizeof(K));                  \
+    memcpy(r->kids, &n->kids[mid + 1], (r->count + 1) * sizeof(void *));       \
+    n->count = mid;                                                            \
+    *sep = n->keys[mid];                                                       \
+    return r;                                                                  \
+  }                                                                            \
+                                                                               \
+  static inline bool name##_insert(name *t, K key, V value) {                  \
+    if (t->root == NULL)                                                       \
+      t->root = name##__node(true);                                            \
+    size_t before = t->count;                                                  \
+    K sep;                                                                     \
+    name##_node *r = name##__insert(t, t->root, key, value, &sep);             \
+    if (r) {                                                                   \
+      name##_node *root = name##__node(false);                                 \
+      root->count = 1;                                                         \
+      root->keys[0] = sep;                                                     \
+      root->kids[0] = t->root;                                                 \
+      root->kids[1] = r;                                                       \
+      t->root = root;                                                          \
+    }                                                                          \
+    return t->count != before;                                                 \
+  }                                                                            \
+                                                                               \
+  /* Refill n->kids[i] which has one key less than allowed */                  \
+  static inline void name##__fix(name##_node *n, size_t i) {                   \
+    name##_node *c = n->kids[i];                                               \
+    name##_node *l = i > 0 ? n->kids[i - 1] : NULL;                            \
+    name##_node *r = i < n->count ? n->kids[i + 1] : NULL;                     \
+    if (l && l->count > __BTREE_MIN) {                                         \
+      memmove(&c->keys[1], &c->keys[0], c->count * sizeof(K));                 \
+      if (c->leaf) {                                                           \
+        memmove(&c->vals[1], &c->vals[0], c->count * sizeof(V));               \
+        c->keys[0] = l->keys[l->count - 1];                                    \
+        c->vals[0] = l->vals[l->count - 1];                                    \
+        n->keys[i - 1] = c->keys[0];                                           \
+      } else {                                                                 \
+        memmove(&c->kids[1], &c->kids[0], (c->count + 1) * sizeof(void *));    \
+        c->keys[0] = n->keys[i - 1];                                           \
+        c->kids[0] = l->kids[l->count];                                        \
+        n->keys[i - 1] = l->keys[l->count - 1];                                \
+      }                                                                        \
+      l->count--;                                                              \
+      c->count++;                                                              \
+      return;                                                                  \
+    }                                                                          \
+    if (r && r->count > __BTREE_MIN) {                                         \
+      if (c->leaf) {                                                           \
+        c->keys[c->count] = r->keys[0];                                        \
+        c->vals[c->count] = r->vals[0];                                        \
+        memmove(&r->vals[0], &r->vals[1], (r->count - 1) * sizeof(V));         \
+        memmove(&r->keys[0], &r->keys[1], (r->count - 1) * sizeof(K));         \
+        n->keys[i] = r->keys[0];                                               \
+      } else {                                                                 \
+        c->keys[c->count] = n->keys[i];                                        \
+        c->kids[c->count + 1] = r->kids[0];                                    \
+        n->keys[i] = r->keys[0];                                               \
+        memmove(&r->keys[0], &r->keys[1], (r->count - 1) * sizeof(K));         \
+        memmove(&r->kids[0], &r->kids[1], r->count * sizeof(void *));          \
+      }                                                                        \
+      r->count--;                                                              \
+      c->count++;                                                              \
+      return;                                                                  \
+    }                                                                          \
+    /* Neither sibling can spare a key, merge with one of them */              \
+    if (l) {                                                                   \
+      i--;                                                                     \
+      r = c;                                                                   \
+    } else {                                                                   \
+      l = c;                                                                   \
+    }                                                                          \
+    if (l->leaf) {                                                             \
+      memcpy(&l->keys[l->count], r->keys, r->count * sizeof(K));               \
+      memcpy(&l->vals[l->count], r->vals, r->count * sizeof(V));               \
+      l->count += r->count;                                                    \
+      l->next = r->next;                                                       \
+    } else {                                                                   \
+      l->keys[l->count] = n->keys[i];                                          \
+      memcpy(&l->keys[l->count + 1], r->keys, r->count * sizeof(K));           \
+      memcpy(&l->kids[l->count + 1], r->kids,                                  \
+             (r->count + 1) * sizeof(void *));                                 \
+      l->count += r->count + 1;                                                \
+    }                                                                          \
+    free(r);                                                                   \
+    memmove(&n->keys[i], &n->keys[i + 1], (n->count - i - 1) * sizeof(K));     \
+    memmove(&n->kids[i + 1], &n->kids[i + 2],                                  \
+            (n->count - i - 1) * sizeof(void *));                              \
+    n->count--;                                                                \
+  }                                                                            \
+                                                                               \
+  static inline bool name##__erase(name##_node *n, K k) {                      \
+    if (n->leaf) {                                                             \
+      size_t i = name##__lower(n, k);                                          \
+      if (i == n->count || less(k, n->keys[i]))                                \
+        return false;                                                          \
+      memmove(&n->keys[i], &n->keys[i + 1], (n->count - i - 1) * sizeof(K));   \
+      memmove(&n->vals[i], &n->vals[i + 1], (n->count - i - 1) * sizeof(V));   \
+      n->count--;                                                              \
+      return true;                                                             \
+    }                                                                          \
+    size_t i = name##__upper(n, k);                                            \
+    if (!name##__erase(n->kids[i], k))                                         \
+      return false;                                                            \
+    if (n->kids[i]->count < __BTREE_MIN)                                       \
+      name##__fix(n, i);                                                       \
+    return true;                                                               \
+  }                                                                            \
+                                                                               \
+  static inline bool name##_erase(name *t, K key) {                            \
+    if (t->root == NULL || !name##__erase(t->root, key))                       \
+      return false;                                                            \
+    t->count--;                                                                \
+    name##_node *root = t->root;                                               \
+    if (!root->leaf && root->count == 0) {                                     \
+      t->root = root->kids[0];                                                 \
+      free(root);                                                              \
+    } else if (root->leaf && root->count == 0) {                               \
+      t->root = NULL;                                                          \
+      free(root);                                                              \
+    }                                                                          \
+    return true;                                                               \
+  }                                                                            \
+                                                                               \
+  static inline void name##__free(name##_node *n) {                            \
+    for (size_t i = 0; !n->leaf && i <= n->count; ++i)                         \
+      name##__free(n->kids[i]);                                                \
+    free(n);                                                                   \
+  }                                                                            \
+  static inline void name##_free(name *t) {                                    \
+    if (t->root)                                                               \
+      name##__free(t->root);                                                   \
+    t->root = NULL;                                                            \
+    t->count = 0;                                                              \
+  }                                                                            \
+                                                                               \
+  static inline void name##_load(name *t, const name##_entry *e, size_t n) {   \
+    name##_free(t);                                                            \
+    if (n == 0)                                                                \
+      return;                                                                  \
+    /* Spread the entries evenly so that every node is at least half full */   \
+    size_t m = (n + BTREE_ORDER - 1) / BTREE_ORDER;                            \
+    name##_node **level = malloc(m * sizeof(*level));                          \
+    K *mins = malloc(m * sizeof(K));                                           \
+    assert(level && mins);                                                     \
+    for (size_t j = 0, at = 0; j < m; ++j) {                                   \
+      name##_node *leaf = name##__node(true);                                  \
+      leaf->count = n / m + (j < n % m);                                       \
+      for (size_t q = 0; q < leaf->count; ++q) {                               \
+        assert((at + q == 0 || less(e[at + q - 1].key, e[at + q].key)) &&      \
+               "Entries must be sorted by strictly increasing key");           \
+        leaf->keys[q] = e[at + q].key;                                         \
+        leaf->vals[q] = e[at + q].value;                                       \
+      }                                                                        \
+      if (j > 0)                                                               \
+        level[j - 1]->next = leaf;                                             \
+      level[j] = leaf;                                                         \
+      mins[j] = leaf->keys[0];                                                 \
+      at += leaf->count;                                                       \
+    }                                                                          \
+    while (m > 1) {                                                            \
+      size_t p = (m + BTREE_ORDER) / (BTREE_ORDER + 1);                        \
+      for (size_t j = 0, at = 0; j < p; ++j) {                                 \
+        name##_node *inner = name##__node(false);                              \
+        size_t take = m / p + (j < m % p);                                     \
+        for (size_t q = 0; q < take; ++q) {                                    \
+          inner->kids[q] = level[at + q];                                      \
+          if (q > 0)                                                           \
+            inner->keys[q - 1] = mins[at + q];                                 \
+        }                                                                      \
+        inner->count = take - 1;                                               \
+        level[j] = inner;                                                      \
+        mins[j] = mins[at];                                                    \
+        at += take;                                                            \
+      }                                                                        \
+      m = p;                                                                   \
+    }                                                                          \
+    t->root = level[0];                                                        \
+    t->count = n;                                                              \
+    free(level);                                                               \
+    free(mins);                                                                \
+  }
+/* End: B-Tree */
+
+/* Start: Ring Buffer */
+/*
+   Bounded lock-free queues. The capacity given to name_init is rounded up to
+   a power of two. Producer and consumer indices live on their own cache
+   lines so the two sides don't invalidate each other on every operation.
+
+   spsc_decl(name, type) declares a wait-free queue for exactly one producer
+   and one consumer thread. mpmc_decl(name, type) declares a Vyukov-style
+   queue any number of threads may push to and pop from. Both generate:
+   ```
+   void name_init(name *q, size_t capacity);
+   bool name_push(name *q, type x);                        // false if full
+   bool name_pop(name *q, type *out);                      // false if empty
+   size_t name_push_n(name *q, const type *xs, size_t n);  // # pushed
+   size_t name_pop_n(name *q, type *out, size_t n);        // # popped
+   void name_free(name *q);
+   ```
+*/
+#define CACHE_LINE 64
+
+static inline size_t __ring_capacity(size_t n) {
+  size_t cap = 2;
+  while (cap < n)
+    cap <<= 1;
+  return cap;
+}
+
+#define spsc_decl(name, type)                                                  \
+  typedef struct {                                                             \
+    _Alignas(CACHE_LINE) _Atomic size_t head; /* Consumer side */              \
+    size_t tail_cache;                                                         \
+    _Alignas(CACHE_LINE) _Atomic size_t tail; /* Producer side */              \
+    size_t head_cache;                                                         \
+    _Alignas(CACHE_LINE) type *items;                                          \
+    size_t mask;                                                               \
+  } name;                                                                      \
+                                                                               \
+  static inline void name##_init(name *q, size_t capacity) {                   \
+    size_t cap = __ring_capacity(capacity);                                    \
+    *q = (name){.mask = cap - 1};                                              \
+    q->items = malloc(cap * sizeof(type));                                     \
+    assert(q->items);                                                          \
+  }                                                                            \
+                                                                               \
+  static inline size_t name##_push_n(name *q, const type *xs, size_t n) {      \
+    size_t t = atomic_load_explicit(&q->tail, memory_order_relaxed);           \
+    size_t cap = q->mask + 1;                                                  \
+    if (cap - (t - q->head_cache) < n) {                                       \
+      q->head_cache = atomic_load_explicit(&q->head, memory_order_acquire);    \
+    }                                                                          \
+    n = MIN(n, cap - (t - q->head_cache));                                     \
+    size_t i = t & q->mask, first = MIN(n, cap - i);                           \
+    memcpy(q->items + i, xs, first * sizeof(type));                            \
+    memcpy(q->items, xs + first, (n - first) * sizeof(type));                  \
+    atomic_store_explicit(&q->tail, t + n, memory_order_release);              \
+    return n;                                                                  \
+  }                                                                            \
+                                                                               \
+  static inline size_t name##_pop_n(name *q, type *out, size_t n) {            \
+    size_t h = atomic_load_explicit(&q->head, memory_order_relaxed);           \
+    if (q->tail_cache - h < n) {                                               \
+      q->tail_cache = atomic_load_explicit(&q->tail, memory_order_acquire);    \
+    }                                                                          \
+    n = MIN(n, q->tail_cache - h);                                             \
+    size_t i = h & q->mask, first = MIN(n, q->mask + 1 - i);                   \
+    memcpy(out, q->items + i, first * sizeof(type));                           \
+    memcpy(out + first, q->items, (n - first) * sizeof(type));                 \
+    atomic_store_explicit(&q->head, h + n, memory_order_release);              \
+    return n;                                                                  \
+  }                                                                            \
+                                                                               \
+  static inline bool name##_push(name *q, type x) {                            \
+    size_t t = atomic_load_explicit(&q->tail, memory_order_relaxed);           \
+    if (t - q->head_cache > q->mask) {                                         \
+      q->head_cache = atomic_load_explicit(&q->head, memory_order_acquire);    \
+      if (t - q->head_cache > q->mask)                                         \
+        return false;                                                          \
+    }                                                                          \
+    q->items[t & q->mask] = x;                                                 \
+    atomic_store_explicit(&q->tail, t + 1, memory_order_release);              \
+    return true;                                                               \
+  }                                                                            \
+                                                                               \
+  static inline bool name##_pop(name *q, type *out) {                          \
+    size_t h = atomic_load_explicit(&q->head, memory_order_relaxed);           \
+    if (h == q->tail_cache) {                                                  \
+      q->tail_cache = atomic_load_explicit(&q->tail, memory_order_acquire);    \
+      if (h == q->tail_cache)                                                  \
+        return false;                                                          \
+    }                                                                          \
+    *out = q->items[h & q->mask];                                              \
+    atomic_store_explicit(&q->head, h + 1, memory_order_release);              \
+    return true;                                                               \
+  }                                                                            \
+                                                                               \
+  static inline void name##_free(name *q) {                                    \
+    free(q->items);                                                            \
+    q->items = NULL;                                                           \
+  }
+
+/*
+   Every cell carries a sequence number: `pos` when it is free for the push
+   that claims position `pos`, `pos + 1` once that push has stored its value,
+   and `pos + capacity` after the matching pop, i.e. free for the next lap.
+*/
+#define mpmc_decl(name, type)                                                  \
+  typedef struct {                                                             \
+    _Atomic size_t seq;                                                        \
+    type value;                                                                \
+  } name##_cell;                                                               \
+                                                                               \
+  typedef struct {                                                             \
+    _Alignas(CACHE_LINE) _Atomic size_t tail; /* Next push */                  \
+    _Alignas(CACHE_LINE) _Atomic size_t head; /* Next pop */                   \
+    _Alignas(CACHE_LINE) name##_cell *items;                                   \
+    size_t mask;                                                               \
+  } name;                                                                      \
+                                                                               \
+  static inline void name##_init(name *q, size_t capacity) {                   \
+    size_t cap = __ring_capacity(capacity);                                    \
+    *q = (name){.mask = cap - 1};                                              \
+    q->items = malloc(cap * sizeof(name##_cell));                              \
+    assert(q->items);                                                          \
+    for (size_t i = 0; i < cap; ++i) {                                         \
+      atomic_init(&q->items[i].seq, i);                                        \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  static inline bool name##_push(name *q, type x) {                            \
+    name##_cell *c;                                                            \
+    size_t pos = atomic_load_explicit(&q->tail, memory_order_relaxed);         \
+    for (;;) {                                                                 \
+      c = &q->items[pos & q->mask];                                            \
+      size_t seq = atomic_load_explicit(&c->seq, memory_order_acquire);        \
+      intptr_t dif = (intptr_t)seq - (intptr_t)pos;                            \
+      if (dif == 0) {                                                          \
+        if (atomic_compare_exchange_weak_explicit(&q->tail, &pos, pos + 1,     \
+                                                  memory_order_relaxed,        \
+                                                  memory_order_relaxed))       \
+          break;                                                               \
+      } else if (dif < 0) {                                                    \
+        return false; /* Full */                                               \
+      } else {                                                                 \
+        pos = atomic_load_explicit(&q->tail, memory_order_relaxed);            \
+      }                                                                        \
+    }                                                                          \
+    c->value = x;                                                              \
+    atomic_store_explicit(&c->seq, pos + 1, memory_order_release);             \
+    return true;                                                               \
+  }                                                                            \
+                                                                               \
+  static inline bool name##_pop(name *q, type *out) {                          \
+    name##_cell *c;                                                            \
+    size_t pos = atomic_load_explicit(&q->head, memory_order_relaxed);         \
+    for (;;) {                                                                 \
+      c = &q->items[pos & q->mask];                                            \
+      size_t seq = atomic_load_explicit(&c->seq, memory_order_acquire);        \
+      intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);                      \
+      if (dif == 0) {                                                          \
+        if (atomic_compare_exchange_weak_explicit(&q->head, &pos, pos + 1,     \
+                                                  memory_order_relaxed,        \
+                                                  memory_order_relaxed))       \
+          break;                                                               \
+      } else if (dif < 0) {                                                    \
+        return false; /* Empty */                                              \
+      } else {                                                                 \
+        pos = atomic_load_explicit(&q->head, memory_order_relaxed);            \
+      }                                                                        \
+    }                                                                          \
+    *out = c->value;                                                           \
+    atomic_store_explicit(&c->seq, pos + q->mask + 1, memory_order_release);   \
+    return true;                                                               \
+  }                                                                            \
+                                                                               \
+  /* Cells are claimed one at a time, a batch may interleave with others */    \
+  static inline size_t name##_push_n(name *q, const type *xs, size_t n) {      \
+    size_t i = 0;                                                              \
+    while (i < n && name##_push(q, xs[i]))                                     \
+      i++;                                                                     \
+    return i;                                                                  \
+  }                                                                            \
+                                                                               \
+  static inline size_t name##_pop_n(name *q, type *out, size_t n) {            \
+    size_t i = 0;                                                              \
+    while (i < n && name##_pop(q, &out[i]))                                    \
+      i++;                                                                     \
+    return i;                                                                  \
+  }                                                                            \
+                                                                               \
+  static inline void name##_free(name *q) {                                    \
+    free(q->items);                                                            \
+    q->items = NULL;                                                           \
+  }
+
+/* End: Ring Buffer */
+
+/* Start: Box */
+#define Box(x)                                                                 \
+  _Generic((x), char *: __box_str, default: __box)(&x, sizeof((x)));
+static inline void *__box(void *x, size_t s) {
+  void *p = malloc(s);
+  memcpy(p, x, s);
+  return p;
+}
+
+static inline char *__box_str(void *x, size_t s) {
+  UNUSED(s);
+  char *str = *(char **)x;
+  return strdup(str);
+}
+
+/* End: Box */
+
+/* Start: Linear Algebra */
+/*
+   A Matrix has the shape:
+   struct {
+     <type> *items;
+     size_t nx;
+     size_t ny;
+   };
+
+   A Vector has shape:
+   struct {
+     <type> *items;
+     size_t n;
+   };
+*/
+#define ma_size(ma) ((ma)->nx * (ma)->ny * sizeof((ma)->items[0]))
+
+#define ma_init(ma)                                                            \
+  do {                                                                         \
+    if (!(ma)->items) {                                                        \
+      (ma)->items = malloc(ma_size((ma)));                                     \
+    }                                                                          \
+    expect((ma)->items != NULL);                                       \
+  } while (0);
+
+/* Returns pointer to element */
+#define ma_at(ma, x, y) ((ma)->items + (ma)->nx * y + x)
+
+#define ma_diag(ma, val)                                                       \
+  do {                                                                         \
+    expect((ma)->nx == (ma)->ny);                                              \
+    ma_fill((ma), 0);                                                          \
+    for (size_t __i = 0; __i < (ma)->nx; ++__i) {                              \
+      *ma_at((ma), __i, __i) = val;                                            \
+    }                                                                          \
+  } while (0);
+
+#define ma_fill(ma, val)                                                       \
+  do {                                                                         \
+    ma_init((ma));                                                             \
+    for (size_t __j = 0; __j < (ma)->nx * (ma)->ny; ++__j) {                   \
+      (ma)->items[__j] = (val);                                                \
+    }                                                                          \
+  } while (0);
+
+#define ma_zero(ma) ma_fill((ma), 0)
+
+#define ma_inbounds(ma, x, y)                                                  \
+  ((0 <= (x) && (x) < (typeof((x)))(ma)->nx) &&                                \
+   (0 <= (y) && (y) < (typeof((y)))(ma)->ny))
+
+#define v_size(v) ((v)->n * sizeof((v)->items[0]))
+#define v_init(v)                                                              \
+  do {                                                                         \
+    if (!(v)->items) {                                                         \
+      (v)->items = malloc(v_size(v));                                          \
+    }                                                                          \
+  } while (0);
+
+#define v_fill(v, val)                                                         \
+  do {                                                                         \
+    for (size_t __i = 0; __i < (v)->n; ++__i) {                                \
+      (v)->items[__i] = (val);                                                 \
+    }                                                                          \
+  } while (0);
+
+/*
+   Vector kernels. __V_KERNELS(T, A, sfx, simd, rsimd) generates
+   __v_<op>_<sfx> for element type T, with integer sums accumulated in A.
+   `simd` is __V_SIMD for types whose element-wise ops and min/max have an
+   AVX2 path, `rsimd` the same for the reductions (dot, sum, norm1): the
+   vector loop handles whole 32-byte lanes and the scalar loop the rest, or
+   everything when AVX2 is not available. The v_* macros dispatch on the
+   element type with _Generic.
+
+   i32 reductions stay scalar because they accumulate in i64, which 32-bit
+   lanes would overflow. i64 stays scalar: AVX2 has no 64-bit multiply, min
+   or max.
+*/
+#ifdef __AVX2__
+#define __V_SIMD(...) __VA_ARGS__
+#else
+#define __V_SIMD(...)
+#endif // __AVX2__
+#define __V_NOSIMD(...)
+
+#define __V_f32(op) _mm256_##op##_ps
+#define __V_f64(op) _mm256_##op##_pd
+#define __V_VT_f32 __m256
+#define __V_VT_f64 __m256d
+
+#ifdef __AVX2__
+#define __V_i32(op) __v256_##op##_i32
+#define __V_VT_i32 __m256i
+static inline __m256i __v256_loadu_i32(const i32 *p) {
+  return _mm256_loadu_si256((const __m256i *)p);
+}
+static inline void __v256_storeu_i32(i32 *p, __m256i v) {
+  _mm256_storeu_si256((__m256i *)p, v);
+}
+#define __v256_add_i32 _mm256_add_epi32
+#define __v256_sub_i32 _mm256_sub_epi32
+#define __v256_mul_i32 _mm256_mullo_epi32
+#define __v256_set1_i32 _mm256_set1_epi32
+#define __v256_min_i32 _mm256_min_epi32
+#define __v256_max_i32 _mm256_max_epi32
+#endif // __AVX2__
+
+#define __V_KERNELS(T, A, sfx, simd, rsimd)                                    \
+  static inline void __v_add_##sfx(T *d, const T *a, const T *b, size_t n) {   \
+    size_t i = 0;                                                              \
+    simd(for (; i + 32 / sizeof(T) <= n; i += 32 / sizeof(T)) {                \
+      __V_##sfx(storeu)(d + i, __V_##sfx(add)(__V_##sfx(loadu)(a + i),         \
+                                              __V_##sfx(loadu)(b + i)));       \
+    })                                                                         \
+    for (; i < n; ++i)                                                         \
+      d[i] = a[i] + b[i];                                                      \
+  }                                                                            \
+                                                                               \
+  static inline void __v_sub_##sfx(T *d, const T *a, const T *b, size_t n) {   \
+    size_t i = 0;                                                              \
+    simd(for (; i + 32 / sizeof(T) <= n; i += 32 / sizeof(T)) {                \
+      __V_##sfx(storeu)(d + i, __V_##sfx(sub)(__V_##sfx(loadu)(a + i),         \
+                                              __V_##sfx(loadu)(b + i)));       \
+    })                                                                         \
+    for (; i < n; ++i)                                                         \
+      d[i] = a[i] - b[i];                                                      \
+  }                                                                            \
+                                                                               \
+  static inline void __v_mul_##sfx(T *d, const T *a, const T *b, size_t n) {   \
+    size_t i = 0;                                                              \
+    simd(for (; i + 32 / sizeof(T) <= n; i += 32 / sizeof(T)) {                \
+      __V_##sfx(storeu)(d + i, __V_##sfx(mul)(__V_##sfx(loadu)(a + i),         \
+                                              __V_##sfx(loadu)(b + i)));       \
+    })                                                                         \
+    for (; i < n; ++i)                                                         \
+      d[i] = a[i] * b[i];                                                      \
+  }                                                                            \
+                                                                               \
+  static inline void __v_scale_##sfx(T *d, T s, size_t n) {                    \
+    size_t i = 0;                                                              \
+    simd(__V_VT_##sfx vs = __V_##sfx(set1)(s);                                 \
+         for (; i + 32 / sizeof(T) <= n; i += 32 / sizeof(T)) {                \
+           __V_##sfx(storeu)(d + i,                                            \
+                             __V_##sfx(mul)(__V_##sfx(loadu)(d + i), vs));     \
+         })                                                                    \
+    for (; i < n; ++i)                                                         \
+      d[i] *= s;                                                               \
+  }                                                                            \
+                                                                               \
+  /* y += a * x */                                                             \
+  static inline void __v_axpy_##sfx(T *y, T a, const T *x, size_t n) {         \
+    size_t i = 0;                                                              \
+    simd(__V_VT_##sfx va = __V_##sfx(set1)(a);                                 \
+         for (; i + 32 / sizeof(T) <= n; i += 32 / sizeof(T)) {                \
+           __V_VT_##sfx vx = __V_##sfx(mul)(va, __V_##sfx(loadu)(x + i));      \
+           __V_##sfx(storeu)(y + i,                                            \
+                             __V_##sfx(add)(__V_##sfx(loadu)(y + i), vx));     \
+         })                                                                    \
+    for (; i < n; ++i)                                                         \
+      y[i] += a * x[i];                                                        \
+  }                                                                            \
+                                                                               \
+  static inline A __v_dot_##sfx(const T *a, const T *b, size_t n) {            \
+    size_t i = 0;                                                              \
+    A acc = 0;                                                                 \
+    rsimd(__V_VT_##sfx va = __V_##sfx(setzero)();                              \
+          for (; i + 32 / sizeof(T) <= n; i += 32 / sizeof(T)) {               \
+            va = __V_##sfx(add)(va, __V_##sfx(mul)(__V_##sfx(loadu)(a + i),    \
+                                                   __V_##sfx(loadu)(b + i)));  \
+          } T lanes[32 / sizeof(T)];                                           \
+          __V_##sfx(storeu)(lanes, va);                                        \
+          for (size_t j = 0; j < ARRAY_LEN(lanes); ++j) acc += lanes[j];)      \
+    for (; i < n; ++i)                                                         \
+      acc += (A)a[i] * b[i];                                                   \
+    return acc;                                                                \
+  }                                                                            \
+                                                                               \
+  static inline A __v_sum_##sfx(const T *a, size_t n) {                        \
+    size_t i = 0;                                                              \
+    A acc = 0;                                                                 \
+    rsimd(__V_VT_##sfx va = __V_##sfx(setzero)();                              \
+          for (; i + 32 / sizeof(T) <= n; i += 32 / sizeof(T)) {               \
+            va = __V_##sfx(add)(va, __V_##sfx(loadu)(a + i));                  \
+          } T lanes[32 / sizeof(T)];                                           \
+          __V_##sfx(storeu)(lanes, va);                                        \
+          for (size_t j = 0; j < ARRAY_LEN(lanes); ++j) acc += lanes[j];)      \
+    for (; i < n; ++i)                                                         \
+      acc += a[i];                                                             \
+    return acc;                                                                \
+  }                                                                            \
+                                                                               \
+  static inline A __v_norm1_##sfx(const T *a, size_t n) {                      \
+    size_t i = 0;                                                              \
+    A acc = 0;                                                                 \
+    rsimd(__V_VT_##sfx va = __V_##sfx(setzero)();                              \
+          __V_VT_##sfx sign = __V_##sfx(set1)(-0.0);                           \
+          for (; i + 32 / sizeof(T) <= n; i += 32 / sizeof(T)) {               \
+            va = __V_##sfx(add)(                                               \
+                va, __V_##sfx(andnot)(sign, __V_##sfx(loadu)(a + i)));         \
+          } T lanes[32 / sizeof(T)];                                           \
+          __V_##sfx(storeu)(lanes, va);                                        \
+          for (size_t j = 0; j < ARRAY_LEN(lanes); ++j) acc += lanes[j];)      \
+    for (; i < n; ++i)                                                         \
+      acc += a[i] < 0 ? -(A)a[i] : (A)a[i];                                    \
+    return acc;                                                                \
+  }                                                                            \
+                                                                               \
+  static inline T __v_min_##sfx(const T *a, size_t n) {                        \
+    assert(n && "Empty vector");                                               \
+    size_t i = 0;                                                              \
+    T m = a[0];                                                                \
+    simd(if (n >= 32 / sizeof(T)) {                                            \
+      __V_VT_##sfx vm = __V_##sfx(loadu)(a);                                   \
+      for (; i + 32 / sizeof(T) <= n; i += 32 / sizeof(T)) {                   \
+        vm = __V_##sfx(min)(vm, __V_##sfx(loadu)(a + i));                      \
+      }                                                                        \
+      T lanes[32 / sizeof(T)];                                                 \
+      __V_##sfx(storeu)(lanes, vm);                                            \
+      for (size_t j = 0; j < ARRAY_LEN(lanes); ++j) m = MIN(m, lanes[j]);      \
+    })                                                                         \
+    for (; i < n; ++i)                                                         \
+      m = MIN(m, a[i]);                                                        \
+    return m;                                                                  \
+  }                                                                            \
+                                                                               \
+  static inline T __v_max_##sfx(const T *a, size_t n) {                        \
+    assert(n && "Empty vector");                                               \
+    size_t i = 0;                                                              \
+    T m = a[0];                                                                \
+    simd(if (n >= 32 / sizeof(T)) {                                            \
+      __V_VT_##sfx vm = __V_##sfx(loadu)(a);                                   \
+      for (; i + 32 / sizeof(T) <= n; i += 32 / sizeof(T)) {                   \
+        vm = __V_##sfx(max)(vm, __V_##sfx(loadu)(a + i));                      \
+      }                                                                        \
+      T lanes[32 / sizeof(T)];                                                 \
+      __V_##sfx(storeu)(lanes, vm);                                            \
+      for (size_t j = 0; j < ARRAY_LEN(lanes); ++j) m = MAX(m, lanes[j]);      \
+    })                                                                         \
+    for (; i < n; ++i)                                                         \
+      m = MAX(m, a[i]);                                                        \
+    return m;                                                                  \
+  }                                                                            \
+                                                                               \
+  /* Index of the first maximum, NaNs are skipped (0 if all are NaN) */       \
+  static inline size_t __v_argmax_##sfx(const T *a, size_t n) {                \
+    assert(n && "Empty vector");                                               \
+    size_t best = 0;                                                           \
+    for (size_t i = 1; i < n; ++i) {                                           \
+      if (a[i] > a[best] || a[best] != a[best])                                \
+        best = i;                                                              \
+    }                                                                          \
+    return a[best] != a[best] ? 0 : best;                                      \
+  }
+
+__V_KERNELS(float, float, f32, __V_SIMD, __V_SIMD)
+__V_KERNELS(double, double, f64, __V_SIMD, __V_SIMD)
+__V_KERNELS(i32, i64, i32, __V_SIMD, __V_NOSIMD)
+__V_KERNELS(i64, i64, i64, __V_NOSIMD, __V_NOSIMD)
+
+#define __v_dispatch(v, op)                                                    \
+  _Generic((v)->items,                                                         \
+      float *: __v_##op##_f32,                                                 \
+      double *: __v_##op##_f64,                                                \
+      i32 *: __v_##op##_i32,                                                   \
+      i64 *: __v_##op##_i64)
+
+#define __v_same_n(a, b) assert((a)->n == (b)->n && "Vector sizes differ")
+
+/* dst = a <op> b, element-wise */
+#define v_add(dst, a, b)                                                       \
+  (__v_same_n((dst), (a)), __v_same_n((dst), (b)),                             \
+   __v_dispatch((dst), add)((dst)->items, (a)->items, (b)->items, (dst)->n))
+#define v_sub(dst, a, b)                                                       \
+  (__v_same_n((dst), (a)), __v_same_n((dst), (b)),                             \
+   __v_dispatch((dst), sub)((dst)->items, (a)->items, (b)->items, (dst)->n))
+#define v_mul(dst, a, b)                                                       \
+  (__v_same_n((dst), (a)), __v_same_n((dst), (b)),                             \
+   __v_dispatch((dst), mul)((dst)->items, (a)->items, (b)->items, (dst)->n))
+
+#define v_scale(v, s) __v_dispatch((v), scale)((v)->items, (s), (v)->n)
+/* y += a * x */
+#define v_axpy(y, a, x)                                                        \
+  (__v_same_n((y), (x)),                                                       \
+   __v_dispatch((y), axpy)((y)->items, (a), (x)->items, (y)->n))
+#define v_dot(a, b)                                                            \
+  (__v_same_n((a), (b)), __v_dispatch((a), dot)((a)->items, (b)->items, (a)->n))
+
+#define v_sum(v) __v_dispatch((v), sum)((v)->items, (v)->n)
+#define v_min(v) __v_dispatch((v), min)((v)->items, (v)->n)
+#define v_max(v) __v_dispatch((v), max)((v)->items, (v)->n)
+#define v_argmax(v) __v_dispatch((v), argmax)((v)->items, (v)->n)
+#define v_norm1(v) __v_dispatch((v), norm1)((v)->items, (v)->n)
+#define v_norm2(v) sqrt((double)v_dot((v), (v)))
+
+#define ma_mul(ma1, ma2) TODO()
+#define ma_mulv(ma, v) TODO()
+
+/*
+   Sparse matrices, with the same (x, y) = (column, row) convention as ma_at.
+
+   A COO matrix is a dynamic array of (x, y, v) triplets, which makes it easy
+   to build. A CSR matrix stores the entries of row y at [rows[y], rows[y + 1])
+   in `cols` and `items`, which makes it fast to multiply. Entries are never
+   merged, duplicates of the same cell add up in every product.
+   ```
+   coo_decl(Coo, float)
+   csr_decl(Csr, float)
+   Coo coo = {.nx = 1000, .ny = 1000};
+   coo_push(&coo, x, y, 1.0f);
+   Csr A = {0};
+   csr_from_coo(&A, &coo);
+   csr_mulv(&A, &v, &out);
+   ```
+   csr_mulv splits rows across threads when compiled with -fopenmp.
+*/
+#define coo_decl(name, type)                                                   \
+  typedef struct {                                                             \
+    struct {                                                                   \
+      size_t x, y;                                                             \
+      type v;                                                                  \
+    } *items;                                                                  \
+    size_t count;                                                              \
+    size_t capacity;                                                           \
+    size_t nx;                                                                 \
+    size_t ny;                                                                 \
+  } name;
+
+#define csr_decl(name, type)                                                   \
+  typedef struct {                                                             \
+    type *items;                                                               \
+    size_t *cols;                                                              \
+    size_t *rows;                                                              \
+    size_t nnz;                                                                \
+    size_t nx;                                                                 \
+    size_t ny;                                                                 \
+  } name;
+
+#define coo_push(coo, __x, __y, __v)                                           \
+  do {                                                                         \
+    assert((size_t)(__x) < (coo)->nx && (size_t)(__y) < (coo)->ny);            \
+    da_append((coo), ((typeof(*(coo)->items)){.x = (__x), .y = (__y),          \
+                                               .v = (__v)}));                  \
+  } while (0);
+
+#ifdef _OPENMP
+#define __SP_PARALLEL _Pragma("omp parallel for schedule(dynamic, 256)")
+#else
+#define __SP_PARALLEL
+#endif // _OPENMP
+
+static inline void __csr_alloc(size_t **rows, size_t **cols, void **items,
+                               size_t ny, size_t nnz, size_t item_size) {
+  *rows = calloc(ny + 1, sizeof(size_t));
+  *cols = malloc(MAX(nnz, 1) * sizeof(size_t));
+  *items = malloc(MAX(nnz, 1) * item_size);
+  assert(*rows && *cols && *items);
+}
+
+/* Turn the per-row counts in rows[1..ny] into offsets, and return a copy of
+ * rows[0..ny) to use as the insertion cursor of each row. */
+static inline size_t *__csr_offsets(size_t *rows, size_t ny) {
+  for (size_t y = 0; y < ny; ++y) {
+    rows[y + 1] += rows[y];
+  }
+  size_t *next = malloc(MAX(ny, 1) * sizeof(size_t));
+  assert(next);
+  memcpy(next, rows, ny * sizeof(size_t));
+  return next;
+}
+
+#define csr_from_coo(csr, coo)                                                 \
+  do {                                                                         \
+    (csr)->nx = (coo)->nx;                                                     \
+    (csr)->ny = (coo)->ny;                                                     \
+    (csr)->nnz = (coo)->count;                                                 \
+    __csr_alloc(&(csr)->rows, &(csr)->cols, (void **)&(csr)->items,            \
+                (csr)->ny, (csr)->nnz, sizeof(*(csr)->items));                 \
+    for (size_t __k = 0; __k < (coo)->count; ++__k) {                          \
+      (csr)->rows[(coo)->items[__k].y + 1]++;                                  \
+    }                                                                          \
+    size_t *__next = __csr_offsets((csr)->rows, (csr)->ny);                    \
+    for (size_t __k = 0; __k < (coo)->count; ++__k) {                          \
+      size_t __p = __next[(coo)->items[__k].y]++;                              \
+      (csr)->cols[__p] = (coo)->items[__k].x;                                  \
+      (csr)->items[__p] = (coo)->items[__k].v;                                 \
+    }                                                                          \
+    free(__next);                                                              \
+  } while (0);
+
+/* dst = src^T, `dst` is overwritten. Columns come out sorted in each row. */
+#define csr_transpose(dst, src)                                                \
+  do {                                                                         \
+    (dst)->nx = (src)->ny;                                                     \
+    (dst)->ny = (src)->nx;                                                     \
+    (dst)->nnz = (src)->nnz;                                                   \
+    __csr_alloc(&(dst)->rows, &(dst)->cols, (void **)&(dst)->items,            \
+                (dst)->ny, (dst)->nnz, sizeof(*(dst)->items));                 \
+    for (size_t __k = 0; __k < (src)->nnz; ++__k) {                            \
+      (dst)->rows[(src)->cols[__k] + 1]++;                                     \
+    }                                                                          \
+    size_t *__next = __csr_offsets((dst)->rows, (dst)->ny);                    \
+    for (size_t __y = 0; __y < (src)->ny; ++__y) {                             \
+      for (size_t __k = (src)->rows[__y]; __k < (src)->rows[__y + 1]; ++__k) { \
+        size_t __p = __next[(src)->cols[__k]]++;                               \
+        (dst)->cols[__p] = __y;                                                \
+        (dst)->items[__p] = (src)->items[__k];                                 \
+      }                                                                        \
+    }                                                                          \
+    free(__next);                                                              \
+  } while (0);
+
+/* out = csr * v, `out` is a vector of size ny, (re)allocated if too small */
+#define csr_mulv(csr, v, out)                                                  \
+  do {                                                                         \
+    assert((v)->n == (csr)->nx);                                               \
+    size_t __have = (out)->items ? v_size((out)) : 0;                          \
+    (out)->n = (csr)->ny;                                                      \
+    if (v_size((out)) > __have) {                                              \
+      (out)->items = realloc((out)->items, v_size((out)));                     \
+      assert((out)->items);                                                    \
+    }                                                                          \
+    __SP_PARALLEL                                                              \
+    for (size_t __y = 0; __y < (csr)->ny; ++__y) {                             \
+      typeof(*(out)->items) __acc = 0;                                         \
+      for (size_t __k = (csr)->rows[__y]; __k < (csr)->rows[__y + 1]; ++__k) { \
+        __acc += (csr)->items[__k] * (v)->items[(csr)->cols[__k]];             \
+      }                                                                        \
+      (out)->items[__y] = __acc;                                               \
+    }                                                                          \
+  } while (0);
+
+/* out = csr * ma, `out` is a dense ny x ma->nx matrix, (re)allocated if too
+   small */
+#define csr_mul_dense(csr, ma, out)                                            \
+  do {                                                                         \
+    assert((ma)->ny == (csr)->nx);                                             \
+    size_t __have = (out)->items ? ma_size((out)) : 0;                         \
+    (out)->nx = (ma)->nx;                                                      \
+    (out)->ny = (csr)->ny;                                                     \
+    if (ma_size((out)) > __have) {                                             \
+      (out)->items = realloc((out)->items, ma_size((out)));                    \
+      assert((out)->items);                                                    \
+    }                                                                          \
+    ma_zero((out));                                                            \
+    __SP_PARALLEL                                                              \
+    for (size_t __y = 0; __y < (csr)->ny; ++__y) {                             \
+      for (size_t __k = (csr)->rows[__y]; __k < (csr)->rows[__y + 1]; ++__k) { \
+        for (size_t __x = 0; __x < (ma)->nx; ++__x) {                          \
+          *ma_at((out), __x, __y) +=                                           \
+              (csr)->items[__k] * *ma_at((ma), __x, (csr)->cols[__k]);         \
+        }                                                                      \
+      }                                                                        \
+    }                                                                          \
+  } while (0);
+
+#define csr_free(csr)                                                          \
+  do {                                                                         \
+    free((csr)->items);                                                        \
+    free((csr)->cols);                                                         \
+    free((csr)->rows);                                                         \
+    (csr)->items = NULL;                                                       \
+    (csr)->cols = (csr)->rows = NULL;                                          \
+    (csr)->nnz = 0;                                                            \
+  } while (0);
+
+typedef struct {
+  ssize_t x, y;
+} Vector2;
+
+typedef struct {
+  ssize_t x, y, z;
+} Vector3;
+
+typedef struct {
+  float x, y;
+} Vector2f;
+
+/* End: Linear Algebra */
+
+/* Start: STRING BUILDER */
+
+/* A string builder is like a dynamic array specialized on strings */
+typedef struct {
+  char *items;
+  size_t count;
+  size_t capacity;
+} String_Builder;
+
+#define sb_append(sb, str)                                                     \
+  do {                                                                         \
+    size_t __l = strlen(str);                                                  \
+    if ((sb)->count == 0)                                                      \
+      da_append(sb, '\0');                                                     \
+    (sb)->count--;                                                             \
+    da_extend((sb), (str), __l);                                               \
+    da_append((sb), '\0');                                                     \
+  } while (0);
+
+#define sb_appends(sb, ...) __sb_appends((sb), __VA_ARGS__, NULL)
+static inline void __sb_appends(String_Builder *sb, ...) {
+  char *s;
+  va_list ap;
+  va_start(ap, sb);
+  s = va_arg(ap, char *);
+  while (s) {
+    sb_append(sb, s);
+    s = va_arg(ap, char *);
   }
 }
 
@@ -332,184 +2277,1404 @@ static inline void __sb_appends(String_Builder *sb, ...) {
     .capacity = strlen(__cstr)                                                 \
   }
 
-#define sb_appendf(sb, fmt, ...)                                               \
-  do {                                                                         \
-    size_t __l = strlen(fmt);                                                  \
-    assert(__l < __TMP_BUF_LEN && "Too long format string");                   \
-    size_t __s = snprintf(__buf, __TMP_BUF_LEN, fmt, __VA_ARGS__);             \
-    sb_append((sb), __buf);                                                    \
-  } while (0);
+#define sb_appendf(sb, fmt, ...)                                               \
+  do {                                                                         \
+    size_t __l = strlen(fmt);                                                  \
+    assert(__l < __TMP_BUF_LEN && "Too long format string");                   \
+    size_t __s = snprintf(__buf, __TMP_BUF_LEN, fmt, __VA_ARGS__);             \
+    UNUSED(__s);                                                               \
+    sb_append((sb), __buf);                                                    \
+  } while (0);
+
+static inline void __sb_read_file_fp(String_Builder *sb, FILE *fp) {
+  __prof_probe(prof_scope("sb_read_file"));
+  long s;
+  expectf(fseek(fp, 0, SEEK_END) == 0, "%s", strerror(errno));
+  s = ftell(fp);
+  expectf(s >= 0, "%s", strerror(errno));
+  rewind(fp);
+  da_reserve(sb, (size_t)s);
+  s = fread(sb->items, 1, s, fp);
+  expectf(s >= 0, "%s", strerror(errno));
+  sb->count = s;
+  __prof_probe(prof_add("sb_read_file.bytes", s));
+}
+
+static inline void __sb_read_file_fd(String_Builder *sb, int fd) {
+  expectf(fd > 0, "%s", "Invalid file descriptor");
+  FILE *fp = fdopen(fd, "r");
+  expectf(fp != NULL, "%s", strerror(errno));
+  __sb_read_file_fp(sb, fp);
+}
+
+static inline void __sb_read_file_char(String_Builder *sb,
+                                       const char *filename) {
+  FILE *fp = fopen(filename, "r");
+  expectf(fp != NULL, "%s", strerror(errno));
+  __sb_read_file_fp(sb, fp);
+  fclose(fp);
+}
+
+#define sb_read_file(sb, file)                                                 \
+  do {                                                                         \
+    _Generic((file),                                                           \
+        char *: __sb_read_file_char,                                           \
+        FILE *: __sb_read_file_fp,                                             \
+        int: __sb_read_file_fd)((sb), (file));                                 \
+  } while (0);
+
+static inline void sb_strip(String_Builder *sb, char c) {
+  if (sb->count == 0)
+    return;
+  if (sb->items[0] == c) {
+    sb->items++; /* LEAK */
+    sb->count--;
+  }
+  if (sb->items[sb->count - 1] == c) {
+    sb->count--;
+  }
+}
+
+typedef struct {
+  const char *buf;
+  size_t size;
+} String_View;
+
+#define sb_find(sb, p)                                                         \
+  _Generic((p), char: sb_find_char, int: sb_find_char, char *: sb_find_str)(   \
+      (sb), p)
+
+static inline String_View sb_find_char(String_Builder *sb, char c) {
+  String_View sv = {0};
+
+  for (size_t i = 0; i < sb->count; ++i) {
+    if (sb->items[i] == c) {
+      sv.buf = &sb->items[i];
+      sv.size = sb->count - (sv.buf - sb->items);
+      break;
+    }
+  }
+
+  return sv;
+}
+
+static inline String_View sb_find_str(String_Builder *sb, const char *s) {
+  String_View sv = {0};
+
+  size_t __l = strlen(s);
+  for (size_t i = 0; i < sb->count; ++i) {
+    if (sb->items[i] == s[0] && i + __l < sb->count) {
+      if (strncmp(&sb->items[i], s, __l) == 0) {
+        sv.buf = &sb->items[i];
+        sv.size = sb->count - (sv.buf - sb->items);
+        break;
+      }
+    }
+  }
+
+  return sv;
+}
+
+static inline String_Builder sv_to_sb(String_View sv) {
+  String_Builder sb = {0};
+  da_extend(&sb, sv.buf, sv.size);
+  da_append(&sb, '\0');
+
+  return sb;
+}
+
+static inline const char *sv_to_cstr(String_View sv) {
+  return strndup(sv.buf, sv.size);
+}
+
+/*
+   Allocation-free number parsing. The sv_parse_* functions parse a number at
+   the start of `sv` and return the number of bytes consumed, or 0 if there is
+   no number there or it does not fit in the result type.
+
+   Digits are consumed 8 at a time with SWAR arithmetic on little-endian
+   targets. sv_parse_f64 takes the exact fast path (Clinger) when the value
+   has at most 19 significant digits, a mantissa below 2^53 and a decimal
+   exponent within +-22. Everything else is rewritten without a decimal
+   point into a bounded stack buffer and parsed by strtod, so the result does
+   not depend on the locale either.
+*/
+#define __F64_DIGITS 768
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+static inline bool __swar_is_8digits(u64 v) {
+  return ((v & 0xF0F0F0F0F0F0F0F0) |
+          (((v + 0x0606060606060606) & 0xF0F0F0F0F0F0F0F0) >> 4)) ==
+         0x3333333333333333;
+}
+
+static inline u32 __swar_parse_8digits(u64 v) {
+  const u64 mask = 0x000000FF000000FF;
+  const u64 mul1 = 100 + (1000000llu << 32);
+  const u64 mul2 = 1 + (10000llu << 32);
+  v -= 0x3030303030303030;
+  v = (v * 10) + (v >> 8);
+  return (((v & mask) * mul1) + (((v >> 16) & mask) * mul2)) >> 32;
+}
+#endif // __BYTE_ORDER__
+
+/* Accumulate the run of digits at p[0..n) into *val, returns its length */
+static inline size_t __sv_digits(const char *p, size_t n, u64 *val,
+                                 bool *overflow) {
+  size_t i = 0;
+  u64 v = *val;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  for (u64 chunk; i + 8 <= n; i += 8) {
+    memcpy(&chunk, p + i, sizeof(chunk));
+    if (!__swar_is_8digits(chunk))
+      break;
+    *overflow |= __builtin_mul_overflow(v, 100000000, &v);
+    *overflow |= __builtin_add_overflow(v, __swar_parse_8digits(chunk), &v);
+  }
+#endif // __BYTE_ORDER__
+  for (; i < n && (unsigned)(p[i] - '0') < 10; ++i) {
+    *overflow |= __builtin_mul_overflow(v, 10, &v);
+    *overflow |= __builtin_add_overflow(v, (u64)(p[i] - '0'), &v);
+  }
+  *val = v;
+  return i;
+}
+
+static inline size_t sv_parse_u64(String_View sv, u64 *out) {
+  u64 v = 0;
+  bool overflow = false;
+  size_t n = __sv_digits(sv.buf, sv.size, &v, &overflow);
+  if (!n || overflow)
+    return 0;
+  *out = v;
+  return n;
+}
 
-static inline void __sb_read_file_fp(String_Builder *sb, FILE *fp) {
-  long s;
-  expectf(fseek(fp, 0, SEEK_END) == 0, "%s", strerror(errno));
-  s = ftell(fp);
-  expectf(s >= 0, "%s", strerror(errno));
-  rewind(fp);
-  da_reserve(sb, (size_t)s);
-  s = fread(sb->items, 1, s, fp);
-  expectf(s >= 0, "%s", strerror(errno));
-  sb->count = s;
+static inline size_t sv_parse_i64(String_View sv, i64 *out) {
+  size_t i = 0;
+  bool neg = false;
+  if (sv.size && (sv.buf[0] == '-' || sv.buf[0] == '+')) {
+    neg = sv.buf[0] == '-';
+    i++;
+  }
+
+  u64 v = 0;
+  bool overflow = false;
+  size_t n = __sv_digits(sv.buf + i, sv.size - i, &v, &overflow);
+  if (!n || overflow || v > (u64)INT64_MAX + neg)
+    return 0;
+  *out = neg ? (i64)(0 - v) : (i64)v;
+  return i + n;
 }
 
-static inline void __sb_read_file_fd(String_Builder *sb, int fd) {
-  expectf(fd > 0, "%s", "Invalid file descriptor");
-  FILE *fp = fdopen(fd, "r");
-  expectf(fp != NULL, "%s", strerror(errno));
-  __sb_read_file_fp(sb, fp);
+static inline size_t sv_parse_f64(String_View sv, double *out) {
+  static const double pow10[] = {
+      1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+      1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+  };
+  const char *p = sv.buf;
+  size_t i = 0;
+  bool neg = false;
+  if (i < sv.size && (p[i] == '-' || p[i] == '+')) {
+    neg = p[i++] == '-';
+  }
+
+  u64 m = 0;
+  bool overflow = false;
+  size_t nint = __sv_digits(p + i, sv.size - i, &m, &overflow), nfrac = 0;
+  i += nint;
+  if (i < sv.size && p[i] == '.') {
+    nfrac = __sv_digits(p + i + 1, sv.size - i - 1, &m, &overflow);
+    if (nint || nfrac)
+      i += 1 + nfrac;
+  }
+  if (!nint && !nfrac)
+    return 0;
+
+  i64 e10 = -(i64)nfrac;
+  if (i < sv.size && (p[i] == 'e' || p[i] == 'E')) {
+    size_t j = i + 1;
+    bool eneg = false, eoverflow = false;
+    if (j < sv.size && (p[j] == '-' || p[j] == '+')) {
+      eneg = p[j++] == '-';
+    }
+    u64 e = 0;
+    size_t ne = __sv_digits(p + j, sv.size - j, &e, &eoverflow);
+    if (ne) {
+      i = j + ne;
+      e = eoverflow ? 100000 : MIN(e, 100000);
+      e10 += eneg ? -(i64)e : (i64)e;
+    }
+  }
+
+  if (!overflow && nint + nfrac <= 19 && m <= (1llu << 53) && e10 >= -22 &&
+      e10 <= 22) {
+    double d = (double)m;
+    d = e10 < 0 ? d / pow10[-e10] : d * pow10[e10];
+    *out = neg ? -d : d;
+    return i;
+  }
+
+  /* Rewrite the number as <digits>e<exponent> in a stack buffer. Without a
+     decimal point strtod does not depend on LC_NUMERIC. The first
+     __F64_DIGITS significant digits decide how any double rounds; later
+     digits only matter as a sticky non-zero digit. */
+  char tmp[__F64_DIGITS + 32];
+  size_t n = 0, start = p[0] == '-' || p[0] == '+';
+  i64 drop = 0;
+  bool sticky = false;
+  if (neg)
+    tmp[n++] = '-';
+  for (size_t k = 0; k < nint + nfrac; ++k) {
+    char dg = k < nint ? p[start + k] : p[start + k + 1];
+    if (dg == '0' && n == (size_t)neg)
+      continue;
+    if (n - neg < __F64_DIGITS) {
+      tmp[n++] = dg;
+    } else {
+      drop++;
+      sticky |= dg != '0';
+    }
+  }
+  if (sticky) {
+    tmp[n++] = '1';
+    drop--;
+  }
+  if (n == (size_t)neg)
+    tmp[n++] = '0';
+  snprintf(tmp + n, sizeof(tmp) - n, "e%lld", (long long)(e10 + drop));
+  *out = strtod(tmp, NULL);
+  return i;
 }
 
-static inline void __sb_read_file_char(String_Builder *sb,
-                                       const char *filename) {
-  FILE *fp = fopen(filename, "r");
-  expectf(fp != NULL, "%s", strerror(errno));
-  __sb_read_file_fp(sb, fp);
-  fclose(fp);
+typedef struct {
+  String_View *items;
+  size_t count;
+  size_t capacity;
+
+  bool is_c_delim;
+  union {
+    char c_delim;
+    char *s_delim;
+  };
+} String_Split;
+
+static inline String_Split _sb_split_char(String_Builder *sb, char c) {
+  expect(sb != NULL);
+
+  String_Builder tmp = *sb;
+  String_Split sp = {0};
+  const char *p = tmp.items;
+  for (;;) {
+    String_View next = sb_find(&tmp, c);
+
+    /* Not found */
+    if (!next.buf) {
+      break;
+    }
+
+    String_View sv = {
+        .buf = p,
+        .size = tmp.count - next.size,
+    };
+
+    /* Skip @c */
+    next.buf++;
+    next.size--;
+
+    da_append(&sp, sv);
+    tmp.items += (next.buf - p);
+    tmp.count -= (next.buf - p);
+
+    p = next.buf;
+  }
+
+  String_View sv = {
+      .buf = tmp.items,
+      .size = tmp.count,
+  };
+
+  da_append(&sp, sv);
+
+  return sp;
 }
 
-#define sb_read_file(sb, file)                                                 \
+static inline String_Split _sb_split_str(String_Builder *sb, char *s) {
+  String_Split sp = {0};
+  TODO();
+
+  UNUSED(sb);
+  UNUSED(s);
+
+  return sp;
+}
+
+#define sb_split(sb, c)                                                        \
+  _Generic((c), int: _sb_split_char, char *: _sb_split_str)((sb), (c));
+
+#define sb_foreach_line(sb, __l)                                               \
+  for ((__l) = strtok((sb)->items, "\n"); (__l); __l = strtok(NULL, "\n"))
+
+/* End: STRING BUILDER */
+
+/* Start: Tokenizer */
+/*
+   Byte classification through a 256 entry table instead of the locale
+   dependent <ctype.h> functions. Every byte belongs to one class (below
+   CC_MAX); next to the table each class keeps a 256 bit membership map laid
+   out for a nibble lookup, which lets the AVX2 path test 32 bytes per step.
+   ```
+   Char_Classes cc = *cc_ascii();        // isalnum/isspace/ispunct in "C"
+   cc_set(&cc, "_'", CC_WORD);            // Customise, or add CC_CUSTOM + k
+   Tokenizer t = tok_init(&cc, sv, CC_BIT(CC_SPACE), CC_BIT(CC_PUNCT));
+   tok_foreach(&t, tok) { ... tok.text, tok.cls ... }
+   ```
+   A token is a maximal run of bytes of one class. Classes in `skip` are
+   dropped, classes in `single` give one byte tokens. Tokens are views into
+   the input, nothing is copied.
+*/
+enum { CC_OTHER, CC_SPACE, CC_WORD, CC_PUNCT, CC_CUSTOM, CC_MAX = 64 };
+#define CC_BIT(cls) (1llu << (cls))
+
+typedef struct {
+  u8 cls[256];
+  /* Byte b is in class k when bit (b >> 4) & 7 of sets[k][(b >> 7) * 16 +
+     (b & 15)] is set */
+  u8 sets[CC_MAX][32];
+} Char_Classes;
+
+typedef struct {
+  String_View text;
+  u8 cls;
+} Token;
+
+typedef struct {
+  const Char_Classes *cc;
+  String_View rest;
+  u64 single;
+  u8 skip[32];
+} Tokenizer;
+
+#define __cc_bit(set, b)                                                       \
+  ((set)[((b) >> 7) * 16 + ((b) & 15)] >> (((b) >> 4) & 7) & 1)
+
+static inline void __cc_put(Char_Classes *cc, u8 b, u8 cls) {
+  assert(cls < CC_MAX && "Class out of range");
+  u8 old = cc->cls[b], bit = 1 << ((b >> 4) & 7);
+  cc->sets[old][(b >> 7) * 16 + (b & 15)] &= ~bit;
+  cc->sets[cls][(b >> 7) * 16 + (b & 15)] |= bit;
+  cc->cls[b] = cls;
+}
+
+static inline void cc_set(Char_Classes *cc, const char *chars, u8 cls) {
+  for (; *chars; ++chars)
+    __cc_put(cc, *chars, cls);
+}
+
+static inline void cc_set_range(Char_Classes *cc, u8 lo, u8 hi, u8 cls) {
+  for (unsigned b = lo; b <= hi; ++b)
+    __cc_put(cc, b, cls);
+}
+
+static inline void __cc_ascii_init(Char_Classes *cc) {
+  *cc = (Char_Classes){0};
+  memset(cc->sets[CC_OTHER], 0xff, sizeof(cc->sets[CC_OTHER]));
+  cc_set_range(cc, '!', '~', CC_PUNCT);
+  cc_set_range(cc, '0', '9', CC_WORD);
+  cc_set_range(cc, 'A', 'Z', CC_WORD);
+  cc_set_range(cc, 'a', 'z', CC_WORD);
+  cc_set(cc, " \t\n\v\f\r", CC_SPACE);
+}
+
+/* The classes of isalnum, isspace and ispunct in the "C" locale, everything
+   else (controls, bytes >= 0x80) is CC_OTHER */
+static Char_Classes __cc_ascii_table;
+static pthread_once_t __cc_ascii_once = PTHREAD_ONCE_INIT;
+static inline void __cc_ascii_build(void) {
+  __cc_ascii_init(&__cc_ascii_table);
+}
+static inline const Char_Classes *cc_ascii(void) {
+  pthread_once(&__cc_ascii_once, __cc_ascii_build);
+  return &__cc_ascii_table;
+}
+
+/* Length of the prefix of p[0..n) whose bytes are all in set */
+static inline size_t __cc_span(const u8 *set, const u8 *p, size_t n) {
+  size_t i = 0;
+#ifdef __AVX2__
+  const __m256i nib = _mm256_set1_epi8(0x0f);
+  const __m256i lo = _mm256_broadcastsi128_si256(
+      _mm_loadu_si128((const __m128i *)set));
+  const __m256i hi = _mm256_broadcastsi128_si256(
+      _mm_loadu_si128((const __m128i *)(set + 16)));
+  const __m256i bits = _mm256_setr_epi8(
+      1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8,
+      16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+  for (; i + 32 <= n; i += 32) {
+    __m256i c = _mm256_loadu_si256((const __m256i *)(p + i));
+    __m256i low = _mm256_and_si256(c, nib);
+    __m256i row = _mm256_blendv_epi8(_mm256_shuffle_epi8(lo, low),
+                                     _mm256_shuffle_epi8(hi, low), c);
+    __m256i bit = _mm256_shuffle_epi8(
+        bits, _mm256_and_si256(_mm256_srli_epi16(c, 4), nib));
+    u32 in = _mm256_movemask_epi8(
+        _mm256_cmpeq_epi8(_mm256_and_si256(row, bit), bit));
+    if (~in)
+      return i + __builtin_ctz(~in);
+  }
+#endif // __AVX2__
+  while (i < n && __cc_bit(set, p[i]))
+    i++;
+  return i;
+}
+
+static inline Tokenizer tok_init(const Char_Classes *cc, String_View sv,
+                                 u64 skip, u64 single) {
+  Tokenizer t = {.cc = cc, .rest = sv, .single = single};
+  for (size_t k = 0; k < CC_MAX; ++k) {
+    for (size_t i = 0; (skip & CC_BIT(k)) && i < sizeof(t.skip); ++i)
+      t.skip[i] |= cc->sets[k][i];
+  }
+  return t;
+}
+
+static inline bool tok_next(Tokenizer *t, Token *tok) {
+  const u8 *p = (const u8 *)t->rest.buf;
+  size_t n = t->rest.size, i = __cc_span(t->skip, p, n), j = i + 1;
+  if (i == n) {
+    t->rest = (String_View){(const char *)p + n, 0};
+    return false;
+  }
+  u8 cls = t->cc->cls[p[i]];
+  if (!(t->single & CC_BIT(cls)))
+    j += __cc_span(t->cc->sets[cls], p + j, n - j);
+  *tok = (Token){{(const char *)p + i, j - i}, cls};
+  t->rest = (String_View){(const char *)p + j, n - j};
+  return true;
+}
+
+#define tok_foreach(t, tok) for (Token tok; tok_next((t), &tok);)
+
+/* Skip a word and the white space after it, returns the part skipped */
+static inline String_View sv_skip_word(String_View *sv) {
+  const Char_Classes *cc = cc_ascii();
+  const u8 *p = (const u8 *)sv->buf;
+  size_t i = __cc_span(cc->sets[CC_WORD], p, sv->size);
+  i += __cc_span(cc->sets[CC_SPACE], p + i, sv->size - i);
+  String_View skipped = {sv->buf, i};
+  *sv = (String_View){sv->buf + i, sv->size - i};
+  return skipped;
+}
+
+/* The next n words with the white space between them, advancing sv past the
+   white space that follows */
+static inline String_View sv_get_words(String_View *sv, int n) {
+  const Char_Classes *cc = cc_ascii();
+  String_View words = {sv->buf, 0};
+  while (n--) {
+    String_View w = sv_skip_word(sv);
+    words.size = w.buf + w.size - words.buf;
+  }
+  while (words.size && cc->cls[(u8)words.buf[words.size - 1]] == CC_SPACE)
+    words.size--;
+  return words;
+}
+
+#define sb_skip_word(sb)                                                       \
   do {                                                                         \
-    _Generic((file),                                                           \
-        char *: __sb_read_file_char,                                           \
-        FILE *: __sb_read_file_fp,                                             \
-        int: __sb_read_file_fd)((sb), (file));                                 \
+    String_View __sv = {(sb)->items, (sb)->count};                             \
+    size_t __n = sv_skip_word(&__sv).size;                                     \
+    (sb)->items += __n;                                                        \
+    (sb)->count -= __n;                                                        \
   } while (0);
 
-static inline void sb_strip(String_Builder *sb, char c) {
-  if (sb->count == 0)
+/* Prefer sv_get_words, this advances sb->items and copies the words */
+static inline char *sb_get_words(String_Builder *sb, int n) {
+  char *tmp = sb->items;
+  while (n--) {
+    sb_skip_word(sb);
+  }
+  return strndup(tmp, sb->items - tmp - 1);
+}
+/* End: Tokenizer */
+
+/* Start: Output */
+/*
+   An Out sink batches output for an fd or a FILE *. Sinks bound to an fd
+   collect it in a String_Builder and write it out in blocks of about
+   OUT_BUFSIZE bytes, using writev to send large blocks (grid rows,
+   out_writev) without copying them into the buffer first. Sinks bound to a
+   FILE * leave the batching to stdio: they write straight into its buffer
+   with fwrite/vfprintf, so they stay in order with everything else written
+   to that FILE *.
+   ```
+   Out o = out_fd(fd);            // or out_file(fp)
+   out_printf(&o, "%d\n", 42);
+   out_grid(&o, &G);
+   out_close(&o);                 // flush and free the buffer
+   ```
+   Write errors are remembered in o.err (an errno) and returned by out_flush
+   and out_close. print, println and grid_print write to out_stdout(), the
+   sink bound to stdout, so they mix freely with printf.
+*/
+#define OUT_BUFSIZE (1 << 16)
+#define __OUT_IOV 1024
+
+typedef struct {
+  String_Builder buf;
+  int fd;
+  FILE *fp;
+  int err;
+} Out;
+
+static inline Out out_fd(int fd) { return (Out){.fd = fd}; }
+static inline Out out_file(FILE *fp) { return (Out){.fd = -1, .fp = fp}; }
+
+/* Write iov[0..n) in full, advancing over short writes */
+static inline int __out_writev(int fd, struct iovec *iov, int n) {
+  while (n > 0) {
+    ssize_t w = writev(fd, iov, MIN(n, __OUT_IOV));
+    if (w < 0 && errno == EINTR)
+      continue;
+    if (w < 0)
+      return errno;
+    for (; n > 0 && (size_t)w >= iov->iov_len; iov++, n--)
+      w -= iov->iov_len;
+    if (n > 0) {
+      iov->iov_base = (char *)iov->iov_base + w;
+      iov->iov_len -= w;
+    }
+  }
+  return 0;
+}
+
+/* Send the buffered bytes followed by iov[0..n) to an fd sink, iov[-1] must
+   be writable */
+static inline void __out_send(Out *o, struct iovec *iov, int n) {
+  assert(!o->fp && "FILE * sinks write through stdio");
+  if (o->buf.count) {
+    iov--;
+    n++;
+    iov[0] = (struct iovec){o->buf.items, o->buf.count};
+  }
+  if (n > 0) {
+    int err = __out_writev(o->fd, iov, n);
+    o->err = o->err ? o->err : err;
+  }
+  o->buf.count = 0;
+}
+
+static inline int out_flush(Out *o) {
+  if (o->fp) {
+    if (fflush(o->fp) != 0)
+      o->err = o->err ? o->err : errno;
+  } else {
+    struct iovec iov[1];
+    __out_send(o, iov + 1, 0);
+  }
+  return o->err;
+}
+
+static inline int out_close(Out *o) {
+  int err = out_flush(o);
+  free(o->buf.items);
+  o->buf = (String_Builder){0};
+  return err;
+}
+
+static inline void out_write(Out *o, const char *s, size_t n) {
+  if (o->fp) {
+    if (fwrite(s, 1, n, o->fp) < n)
+      o->err = o->err ? o->err : EIO;
     return;
-  if (sb->items[0] == c) {
-    sb->items++; /* LEAK */
-    sb->count--;
   }
-  if (sb->items[sb->count - 1] == c) {
-    sb->count--;
+  if (o->buf.count + n > OUT_BUFSIZE) {
+    struct iovec iov[2] = {{0}, {(void *)s, n}};
+    if (n >= OUT_BUFSIZE) {
+      __out_send(o, iov + 1, 1);
+      return;
+    }
+    __out_send(o, iov + 1, 0);
+  }
+  da_extend(&o->buf, s, n);
+}
+
+static inline void out_putc(Out *o, char ch) { out_write(o, &ch, 1); }
+static inline void out_puts(Out *o, const char *s) {
+  out_write(o, s, strlen(s));
+}
+static inline void out_sv(Out *o, String_View sv) {
+  out_write(o, sv.buf, sv.size);
+}
+
+/* Like printf: returns the number of bytes written, negative on error */
+__attribute__((format(printf, 2, 3)))
+static inline int out_printf(Out *o, const char *fmt, ...) {
+  va_list ap;
+  int n = -1;
+  if (o->fp) {
+    va_start(ap, fmt);
+    n = vfprintf(o->fp, fmt, ap);
+    va_end(ap);
+    if (n < 0)
+      o->err = o->err ? o->err : EIO;
+    return n;
+  }
+  for (int pass = 0; pass < 2; ++pass) {
+    size_t room = o->buf.capacity - o->buf.count;
+    va_start(ap, fmt);
+    n = vsnprintf(o->buf.items + o->buf.count, room, fmt, ap);
+    va_end(ap);
+    if (n < 0)
+      return n;
+    if ((size_t)n < room) {
+      o->buf.count += n;
+      if (o->buf.count >= OUT_BUFSIZE)
+        out_flush(o);
+      return n;
+    }
+    da_reserve_with(&o->buf, o->buf.count + n + 1, DA_GROWTH);
+  }
+  return n;
+}
+
+static inline void __out_iov(Out *o, struct iovec *iov, int n) {
+  size_t total = 0;
+  for (int i = 0; i < n; ++i)
+    total += iov[i].iov_len;
+  if (o->fp || o->buf.count + total <= OUT_BUFSIZE) {
+    for (int i = 0; i < n; ++i)
+      out_write(o, iov[i].iov_base, iov[i].iov_len);
+    return;
+  }
+  __out_send(o, iov, n);
+}
+
+/* Write iov[0..n), copying small batches and passing large ones through */
+static inline void out_writev(Out *o, const struct iovec *iov, int n) {
+  struct iovec v[__OUT_IOV + 1];
+  for (int i = 0; i < n; i += __OUT_IOV) {
+    int m = MIN(n - i, __OUT_IOV);
+    memcpy(v + 1, iov + i, m * sizeof(*v));
+    __out_iov(o, v + 1, m);
+  }
+}
+
+static inline Out *out_stdout(void) {
+  static Out o = {.fd = -1};
+  o.fp = stdout;
+  return &o;
+}
+
+static inline void __print_int(int x) { out_printf(out_stdout(), "%d\n", x); }
+static inline void __print_str(char *x) {
+  out_puts(out_stdout(), x);
+  out_putc(out_stdout(), '\n');
+}
+#define print(x) _Generic((x), int: __print_int, char *: __print_str)(x);
+#define println(fmt, ...) (out_printf(out_stdout(), fmt "\n", __VA_ARGS__))
+/* End: Output */
+
+/* Start: Multi-pattern search */
+/*
+   A Matcher finds any of a set of patterns in one pass over the input. It is
+   an Aho-Corasick automaton compiled to a dense transition table over byte
+   classes (bytes that appear in no pattern share one class), so each input
+   byte costs one table load.
+   ```
+   const char *words[] = {"error", "warn", "fatal"};
+   Matcher m = matcher_build(words, 3);
+   matcher_scan(&m, sv, on_match, ctx); // on_match(pos, id, ctx) per match
+   matcher_free(&m);
+   ```
+   Matches are reported in the order in which they end, overlapping ones
+   included, with `pos` the offset at which the match starts and `id` the
+   index of the pattern. The callback returns false to stop the scan.
+
+   While the automaton sits in its start state it skips ahead to the next
+   byte that can start a pattern. With AVX2 and at most __MATCH_TEDDY_MAX
+   patterns that search is Teddy: the first two bytes of every pattern are
+   looked up by nibble in shuffle masks, 32 input positions at a time.
+
+   matcher_feed scans a stream chunk by chunk. Match_State carries the
+   automaton state between chunks, so matches that straddle a chunk border
+   are found, and positions are counted from the start of the stream.
+*/
+#define MATCH_NONE ((u32)-1)
+#define __MATCH_TEDDY_MAX 32
+
+typedef bool (*match_fn)(u64 pos, u32 id, void *ctx);
+
+typedef struct {
+  u32 *next;  /* nstates x nclasses transitions */
+  u32 *hit;   /* First state on the fail chain with a pattern ending, or 0 */
+  u32 *dict;  /* Next such state after this one */
+  u32 *term;  /* First pattern ending in a state */
+  u32 *chain; /* Next pattern with the same text */
+  u32 *lens;
+  u32 nstates, nclasses, npatterns;
+  u8 classes[256];
+  bool start[256];
+  int teddy; /* Fingerprint length, 0 without the Teddy prefilter */
+  u8 masks[2][2][16];
+} Matcher;
+
+typedef struct {
+  u32 state;
+  u64 offset;
+} Match_State;
+
+typedef struct {
+  u64 pos;
+  u32 id;
+} Match;
+
+da_decl(Matches, Match)
+
+static inline Matcher matcher_build_sv(const String_View *patterns, size_t n) {
+  Matcher m = {.npatterns = n};
+  for (size_t p = 0; p < n; ++p) {
+    assert(patterns[p].size > 0 && "Empty pattern");
+    for (size_t i = 0; i < patterns[p].size; ++i)
+      m.classes[(u8)patterns[p].buf[i]] = 1;
+  }
+  m.nclasses = 1;
+  for (size_t b = 0; b < 256; ++b)
+    m.classes[b] = m.classes[b] ? m.nclasses++ : 0;
+
+  /* Trie, 0 meaning no edge since nothing leads back to the root */
+  da_decl(__U32s, u32);
+  __U32s next = {0}, term = {0};
+  m.nstates = 1;
+  da_resize(&next, m.nclasses, 0);
+  da_append(&term, MATCH_NONE);
+  /* n may be 0, an empty matcher never matches */
+  m.chain = malloc(MAX(n, 1) * sizeof(u32));
+  m.lens = malloc(MAX(n, 1) * sizeof(u32));
+  assert(m.chain && m.lens);
+  size_t minlen = SIZE_MAX;
+  for (size_t p = 0; p < n; ++p) {
+    u32 s = 0;
+    for (size_t i = 0; i < patterns[p].size; ++i) {
+      u32 *t = &next.items[s * m.nclasses + m.classes[(u8)patterns[p].buf[i]]];
+      if (*t == 0) {
+        *t = m.nstates++;
+        da_resize(&next, m.nstates * m.nclasses, 0);
+        da_append(&term, MATCH_NONE);
+        t = &next.items[s * m.nclasses + m.classes[(u8)patterns[p].buf[i]]];
+      }
+      s = *t;
+    }
+    m.lens[p] = patterns[p].size;
+    minlen = MIN(minlen, patterns[p].size);
+    /* Keep the chain in pattern order */
+    u32 *at = &term.items[s];
+    while (*at != MATCH_NONE)
+      at = &m.chain[*at];
+    *at = p;
+    m.chain[p] = MATCH_NONE;
+    m.start[(u8)patterns[p].buf[0]] = true;
+  }
+  m.next = next.items;
+  m.term = term.items;
+
+  /* Breadth first, so the fail state of every state is complete before it */
+  u32 *fail = calloc(m.nstates, sizeof(u32));
+  u32 *queue = malloc(m.nstates * sizeof(u32));
+  m.hit = calloc(m.nstates, sizeof(u32));
+  m.dict = calloc(m.nstates, sizeof(u32));
+  assert(fail && queue && m.hit && m.dict);
+  size_t head = 0, tail = 0;
+  queue[tail++] = 0;
+  while (head < tail) {
+    u32 s = queue[head++], *row = &m.next[s * m.nclasses];
+    for (u32 k = 0; k < m.nclasses; ++k) {
+      u32 f = s ? m.next[fail[s] * m.nclasses + k] : 0;
+      if (row[k] == 0) {
+        row[k] = f;
+        continue;
+      }
+      u32 t = row[k];
+      fail[t] = f;
+      m.dict[t] = m.hit[f];
+      m.hit[t] = m.term[t] != MATCH_NONE ? t : m.dict[t];
+      queue[tail++] = t;
+    }
+  }
+  free(fail);
+  free(queue);
+
+#ifdef __AVX2__
+  if (n > 0 && n <= __MATCH_TEDDY_MAX) {
+    m.teddy = MIN(minlen, 2);
+    for (size_t p = 0; p < n; ++p) {
+      for (int j = 0; j < m.teddy; ++j) {
+        u8 b = patterns[p].buf[j];
+        m.masks[j][0][b & 15] |= 1 << (p % 8);
+        m.masks[j][1][b >> 4] |= 1 << (p % 8);
+      }
+    }
+  }
+#endif // __AVX2__
+  UNUSED(minlen);
+  return m;
+}
+
+static inline Matcher matcher_build(const char **patterns, size_t n) {
+  String_View *sv = malloc(MAX(n, 1) * sizeof(*sv));
+  assert(sv);
+  for (size_t p = 0; p < n; ++p)
+    sv[p] = (String_View){patterns[p], strlen(patterns[p])};
+  Matcher m = matcher_build_sv(sv, n);
+  free(sv);
+  return m;
+}
+
+static inline void matcher_free(Matcher *m) {
+  free(m->next);
+  free(m->hit);
+  free(m->dict);
+  free(m->term);
+  free(m->chain);
+  free(m->lens);
+  *m = (Matcher){0};
+}
+
+/* Next position >= i at which a pattern may start, n if there is none */
+static inline size_t __matcher_skip(const Matcher *m, const u8 *p, size_t i,
+                                    size_t n) {
+#ifdef __AVX2__
+  if (m->teddy) {
+    const __m256i nib = _mm256_set1_epi8(0x0f);
+    __m256i lo0 = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128((const __m128i *)m->masks[0][0]));
+    __m256i hi0 = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128((const __m128i *)m->masks[0][1]));
+    __m256i lo1 = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128((const __m128i *)m->masks[1][0]));
+    __m256i hi1 = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128((const __m128i *)m->masks[1][1]));
+    for (; i + 33 <= n; i += 32) {
+      __m256i c = _mm256_loadu_si256((const __m256i *)(p + i));
+      __m256i v = _mm256_and_si256(
+          _mm256_shuffle_epi8(lo0, _mm256_and_si256(c, nib)),
+          _mm256_shuffle_epi8(hi0,
+                              _mm256_and_si256(_mm256_srli_epi16(c, 4), nib)));
+      if (m->teddy == 2) {
+        c = _mm256_loadu_si256((const __m256i *)(p + i + 1));
+        v = _mm256_and_si256(
+            v, _mm256_and_si256(
+                   _mm256_shuffle_epi8(lo1, _mm256_and_si256(c, nib)),
+                   _mm256_shuffle_epi8(
+                       hi1, _mm256_and_si256(_mm256_srli_epi16(c, 4), nib))));
+      }
+      u32 hits = ~(u32)_mm256_movemask_epi8(
+          _mm256_cmpeq_epi8(v, _mm256_setzero_si256()));
+      if (hits)
+        return i + __builtin_ctz(hits);
+    }
+  }
+#endif // __AVX2__
+  while (i < n && !m->start[p[i]])
+    i++;
+  return i;
+}
+
+static inline bool matcher_feed(const Matcher *m, Match_State *st,
+                                String_View chunk, match_fn cb, void *ctx) {
+  const u8 *p = (const u8 *)chunk.buf;
+  size_t n = chunk.size;
+  u32 s = st->state;
+  bool more = true;
+  for (size_t i = 0; i < n && more;) {
+    if (s == 0) {
+      i = __matcher_skip(m, p, i, n);
+      if (i == n)
+        break;
+    }
+    s = m->next[s * m->nclasses + m->classes[p[i++]]];
+    for (u32 t = m->hit[s]; t && more; t = m->dict[t]) {
+      for (u32 id = m->term[t]; id != MATCH_NONE && more; id = m->chain[id])
+        more = cb(st->offset + i - m->lens[id], id, ctx);
+    }
   }
+  st->state = s;
+  st->offset += n;
+  return more;
 }
 
-typedef struct {
-  const char *buf;
-  size_t size;
-} String_View;
+static inline bool matcher_scan(const Matcher *m, String_View sv, match_fn cb,
+                                void *ctx) {
+  Match_State st = {0};
+  return matcher_feed(m, &st, sv, cb, ctx);
+}
 
-#define sb_find(sb, p)                                                         \
-  _Generic((p), char: sb_find_char, int: sb_find_char, char *: sb_find_str)(   \
-      (sb), p)
+static inline bool __matcher_collect(u64 pos, u32 id, void *ctx) {
+  da_append((Matches *)ctx, ((Match){pos, id}));
+  return true;
+}
 
-static inline String_View sb_find_char(String_Builder *sb, char c) {
-  String_View sv = {0};
+/* Append every match in sv to out */
+static inline void matcher_find_all(const Matcher *m, String_View sv,
+                                    Matches *out) {
+  matcher_scan(m, sv, __matcher_collect, out);
+}
 
-  for (size_t i = 0; i < sb->count; ++i) {
-    if (sb->items[i] == c) {
-      sv.buf = &sb->items[i];
-      sv.size = sb->count - (sv.buf - sb->items);
-      break;
-    }
-  }
+static inline bool __matcher_first(u64 pos, u32 id, void *ctx) {
+  *(Match *)ctx = (Match){pos, id};
+  return false;
+}
 
-  return sv;
+/* Like sb_find_str for a set of needles: the view starts at the first match
+   to end, *id (if not NULL) is set to its pattern */
+static inline String_View sb_find_any(String_Builder *sb, const Matcher *m,
+                                      u32 *id) {
+  Match first = {.id = MATCH_NONE};
+  matcher_scan(m, (String_View){sb->items, sb->count}, __matcher_first, &first);
+  if (id)
+    *id = first.id;
+  if (first.id == MATCH_NONE)
+    return (String_View){0};
+  return (String_View){sb->items + first.pos, sb->count - first.pos};
 }
+/* End: Multi-pattern search */
 
-static inline String_View sb_find_str(String_Builder *sb, const char *s) {
-  String_View sv = {0};
+/* Start: Parallel */
+/*
+   Parallel record processing over an in-memory buffer. The buffer is cut
+   into chunks that end right after a delimiter, so no record straddles two
+   chunks, and worker threads take chunks off a shared counter. `record` is
+   called for every record (without its delimiter) with the state of the
+   chunk it belongs to: `local_size` zeroed bytes. Once all chunks are done
+   the states are folded into `result` in buffer order with `merge`.
+   ```
+   Parallel_Foreach pf = {
+       .record = count_fields,
+       .merge = par_merge_counters,
+       .local_size = sizeof(Counts),
+   };
+   Counts total;
+   sb_parallel_foreach(&sb, &pf, &total);
+   ```
+*/
+typedef struct {
+  void (*record)(String_View rec, void *local, void *ctx);
+  void (*merge)(void *acc, void *local, size_t size, void *ctx);
+  size_t local_size;
+  size_t nthreads; /* 0: one per online CPU */
+  char delim;      /* 0: '\n' */
+  void *ctx;
+} Parallel_Foreach;
 
-  size_t __l = strlen(s);
-  for (size_t i = 0; i < sb->count; ++i) {
-    if (sb->items[i] == s[0] && i + __l < sb->count) {
-      if (strncmp(&sb->items[i], s, __l) == 0) {
-        sv.buf = &sb->items[i];
-        sv.size = sb->count - (sv.buf - sb->items);
-        break;
-      }
+#define __PAR_MIN_CHUNK (64 * 1024)
+#define __PAR_CHUNKS_PER_THREAD 4
+
+typedef struct {
+  const Parallel_Foreach *pf;
+  String_View *chunks;
+  char *locals;
+  size_t nchunks;
+  _Atomic size_t next;
+} __par_job;
+
+static inline void *__par_worker(void *arg) {
+  __par_job *job = arg;
+  const Parallel_Foreach *pf = job->pf;
+  char delim = pf->delim ? pf->delim : '\n';
+  size_t c;
+  while ((c = atomic_fetch_add(&job->next, 1)) < job->nchunks) {
+    void *local = job->locals + c * pf->local_size;
+    const char *p = job->chunks[c].buf, *end = p + job->chunks[c].size;
+    while (p < end) {
+      const char *q = memchr(p, delim, end - p);
+      if (!q)
+        q = end;
+      pf->record((String_View){.buf = p, .size = q - p}, local, pf->ctx);
+      p = q + 1;
     }
   }
-
-  return sv;
+  return NULL;
 }
 
-static inline String_Builder sv_to_sb(String_View sv) {
-  String_Builder sb = {0};
-  da_reserve(&sb, sv.size);
-  memcpy(sb.items, sv.buf, sv.size);
-  sb.count = sv.size;
-  da_append(&sb, '\0');
+static inline void sv_parallel_foreach(String_View buf,
+                                       const Parallel_Foreach *pf,
+                                       void *result) {
+  char delim = pf->delim ? pf->delim : '\n';
+  size_t nthreads = pf->nthreads;
+  if (!nthreads) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    nthreads = n > 0 ? n : 1;
+  }
+  size_t nchunks = MIN(nthreads * __PAR_CHUNKS_PER_THREAD,
+                       MAX(buf.size / __PAR_MIN_CHUNK, (size_t)1));
+
+  __par_job job = {.pf = pf};
+  job.chunks = malloc(nchunks * sizeof(String_View));
+  job.locals = calloc(nchunks, MAX(pf->local_size, (size_t)1));
+  assert(job.chunks && job.locals);
+
+  const char *start = buf.buf, *end = buf.buf + buf.size;
+  for (size_t k = 1; k <= nchunks && start < end; ++k) {
+    const char *stop = end;
+    if (k < nchunks) {
+      const char *cut = buf.buf + buf.size * k / nchunks;
+      stop = memchr(cut, delim, end - cut);
+      stop = stop ? stop + 1 : end;
+    }
+    if (stop <= start)
+      continue;
+    job.chunks[job.nchunks].buf = start;
+    job.chunks[job.nchunks++].size = stop - start;
+    start = stop;
+  }
 
-  return sb;
+  nthreads = MIN(nthreads, job.nchunks);
+  pthread_t *threads = malloc(MAX(nthreads, (size_t)1) * sizeof(pthread_t));
+  assert(threads);
+  for (size_t t = 1; t < nthreads; ++t) {
+    expect(pthread_create(&threads[t], NULL, __par_worker, &job) == 0);
+  }
+  __par_worker(&job);
+  for (size_t t = 1; t < nthreads; ++t) {
+    pthread_join(threads[t], NULL);
+  }
+
+  memcpy(result, job.locals, pf->local_size);
+  for (size_t c = 1; c < job.nchunks; ++c) {
+    pf->merge(result, job.locals + c * pf->local_size, pf->local_size, pf->ctx);
+  }
+  free(threads);
+  free(job.locals);
+  free(job.chunks);
 }
 
-static inline const char *sv_to_cstr(String_View sv) {
-  return strndup(sv.buf, sv.size);
+#define sb_parallel_foreach(sb, pf, result)                                    \
+  sv_parallel_foreach((String_View){.buf = (sb)->items, .size = (sb)->count},  \
+                      (pf), (result))
+
+/* Merge for states that are arrays of u64 counters */
+static inline void par_merge_counters(void *acc, void *local, size_t size,
+                                      void *ctx) {
+  UNUSED(ctx);
+  u64 *a = acc, *l = local;
+  for (size_t i = 0; i < size / sizeof(u64); ++i) {
+    a[i] += l[i];
+  }
 }
 
-typedef struct {
-  String_View *items;
-  size_t count;
-  size_t capacity;
+/* Merge for states that are a String_Split, `local` is freed */
+static inline void par_merge_split(void *acc, void *local, size_t size,
+                                   void *ctx) {
+  UNUSED(size);
+  UNUSED(ctx);
+  String_Split *a = acc, *l = local;
+  da_extend(a, l->items, l->count);
+  free(l->items);
+}
 
-  bool is_c_delim;
-  union {
-    char c_delim;
-    char *s_delim;
-  };
-} String_Split;
+/* End: Parallel */
 
-static inline String_Split _sb_split_char(String_Builder *sb, char c) {
-  expect(sb != NULL);
+/* Start: Batch IO */
+/*
+   sb_read_files reads paths[0..n) concurrently. With out != NULL file i ends
+   up in out[i] (its previous contents are replaced, like sb_read_file). With
+   cb != NULL, cb is called once per file as soon as it is complete, `err`
+   being 0 or the errno that made it fail. Callbacks never run concurrently.
+   Returns the number of files that failed.
+
+   On Linux the opens and reads are submitted through io_uring, keeping up to
+   __LOAD_DEPTH files in flight. When io_uring is not available (old kernel,
+   seccomp, PJ_NO_IO_URING) it falls back to sb_read_files_pool, which runs
+   open/fstat/pread on __LOAD_THREADS threads.
+*/
+typedef void (*sb_load_fn)(size_t i, const char *path, String_Builder *sb,
+                           int err, void *ctx);
 
-  String_Builder tmp = *sb;
-  String_Split sp = {0};
-  const char *p = tmp.items;
-  for (;;) {
-    String_View next = sb_find(&tmp, c);
+#define __LOAD_DEPTH 64
+#define __LOAD_THREADS 16
 
-    /* Not found */
-    if (!next.buf) {
-      break;
-    }
+typedef struct {
+  const char **paths;
+  size_t n;
+  String_Builder *out;
+  sb_load_fn cb;
+  void *ctx;
+  _Atomic size_t next;
+  _Atomic size_t failed;
+  pthread_mutex_t lock;
+} __load_job;
+
+/* Hand over a finished file, takes ownership of sb */
+static inline void __load_deliver(__load_job *job, size_t i, String_Builder sb,
+                                  int err) {
+  if (err)
+    job->failed++;
+  String_Builder *dst = job->out ? &job->out[i] : &sb;
+  if (job->out) {
+    free(dst->items);
+    *dst = sb;
+  }
+  if (job->cb) {
+    pthread_mutex_lock(&job->lock);
+    job->cb(i, job->paths[i], dst, err, job->ctx);
+    pthread_mutex_unlock(&job->lock);
+  }
+  if (!job->out)
+    free(sb.items);
+}
 
-    String_View sv = {
-        .buf = p,
-        .size = tmp.count - next.size,
-    };
+static inline int __load_fd(int fd, String_Builder *sb) {
+  struct stat st;
+  if (fstat(fd, &st) < 0)
+    return errno;
+  da_reserve(sb, (size_t)st.st_size + 1);
+  while (sb->count < (size_t)st.st_size) {
+    ssize_t r = pread(fd, sb->items + sb->count, st.st_size - sb->count,
+                      sb->count);
+    if (r < 0 && errno == EINTR)
+      continue;
+    if (r < 0)
+      return errno;
+    if (r == 0)
+      break;
+    sb->count += r;
+  }
+  return 0;
+}
 
-    /* Skip @c */
-    next.buf++;
-    next.size--;
+static inline void *__load_worker(void *arg) {
+  __load_job *job = arg;
+  size_t i;
+  while ((i = atomic_fetch_add(&job->next, 1)) < job->n) {
+    String_Builder sb = {0};
+    int err = 0, fd = open(job->paths[i], O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      err = errno;
+    } else {
+      err = __load_fd(fd, &sb);
+      close(fd);
+    }
+    __load_deliver(job, i, sb, err);
+  }
+  return NULL;
+}
 
-    da_append(&sp, sv);
-    tmp.items += (next.buf - p);
-    tmp.count -= (next.buf - p);
+static inline size_t sb_read_files_pool(const char **paths, size_t n,
+                                        String_Builder *out, sb_load_fn cb,
+                                        void *ctx) {
+  __load_job job = {.paths = paths, .n = n, .out = out, .cb = cb, .ctx = ctx};
+  pthread_mutex_init(&job.lock, NULL);
+  size_t nthreads = MIN(n, (size_t)__LOAD_THREADS);
+  pthread_t threads[__LOAD_THREADS];
+  size_t started = 0;
+  /* Fewer threads just means more work for the others, this one included */
+  for (size_t t = 1; t < nthreads; ++t) {
+    if (pthread_create(&threads[started], NULL, __load_worker, &job) != 0)
+      break;
+    started++;
+  }
+  __load_worker(&job);
+  for (size_t t = 0; t < started; ++t) {
+    pthread_join(threads[t], NULL);
+  }
+  pthread_mutex_destroy(&job.lock);
+  return job.failed;
+}
 
-    p = next.buf;
+#ifdef __PJ_IO_URING
+typedef struct {
+  int fd;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  _Atomic u32 *sq_tail, *cq_head, *cq_tail;
+  u32 *sq_array, sq_mask, cq_mask;
+  void *sq_map, *cq_map;
+  size_t sq_size, cq_size, sqes_size;
+} __uring;
+
+static inline bool __uring_init(__uring *r, u32 entries) {
+  struct io_uring_params p = {0};
+  *r = (__uring){0};
+  r->fd = syscall(__NR_io_uring_setup, entries, &p);
+  if (r->fd < 0)
+    return false;
+  /* IORING_OP_OPENAT and IORING_OP_READ came with the same kernel (5.6) */
+  if (!(p.features & IORING_FEAT_RW_CUR_POS)) {
+    close(r->fd);
+    return false;
   }
 
-  String_View sv = {
-      .buf = tmp.items,
-      .size = tmp.count,
-  };
+  r->sq_size = p.sq_off.array + p.sq_entries * sizeof(u32);
+  r->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP)
+    r->sq_size = r->cq_size = MAX(r->sq_size, r->cq_size);
+  r->sq_map = mmap(NULL, r->sq_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+  r->cq_map = (p.features & IORING_FEAT_SINGLE_MMAP)
+                  ? r->sq_map
+                  : mmap(NULL, r->cq_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+  r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+  r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+  if (r->sq_map == MAP_FAILED || r->cq_map == MAP_FAILED ||
+      r->sqes == MAP_FAILED) {
+    if (r->sqes != MAP_FAILED)
+      munmap(r->sqes, r->sqes_size);
+    if (r->cq_map != MAP_FAILED && r->cq_map != r->sq_map)
+      munmap(r->cq_map, r->cq_size);
+    if (r->sq_map != MAP_FAILED)
+      munmap(r->sq_map, r->sq_size);
+    close(r->fd);
+    return false;
+  }
 
-  da_append(&sp, sv);
+  r->sq_tail = (void *)((char *)r->sq_map + p.sq_off.tail);
+  r->sq_mask = *(u32 *)((char *)r->sq_map + p.sq_off.ring_mask);
+  r->sq_array = (void *)((char *)r->sq_map + p.sq_off.array);
+  r->cq_head = (void *)((char *)r->cq_map + p.cq_off.head);
+  r->cq_tail = (void *)((char *)r->cq_map + p.cq_off.tail);
+  r->cq_mask = *(u32 *)((char *)r->cq_map + p.cq_off.ring_mask);
+  r->cqes = (void *)((char *)r->cq_map + p.cq_off.cqes);
+  return true;
+}
 
-  return sp;
+static inline void __uring_free(__uring *r) {
+  munmap(r->sqes, r->sqes_size);
+  if (r->cq_map != r->sq_map)
+    munmap(r->cq_map, r->cq_size);
+  munmap(r->sq_map, r->sq_size);
+  close(r->fd);
 }
 
-static inline String_Split _sb_split_str(String_Builder *sb, char *s) {
-  String_Split sp = {0};
-  TODO();
+/* Queue an SQE; the caller never has more than the ring size in flight */
+static inline struct io_uring_sqe *__uring_sqe(__uring *r) {
+  u32 tail = atomic_load_explicit(r->sq_tail, memory_order_relaxed);
+  u32 i = tail & r->sq_mask;
+  struct io_uring_sqe *sqe = &r->sqes[i];
+  memset(sqe, 0, sizeof(*sqe));
+  r->sq_array[i] = i;
+  atomic_store_explicit(r->sq_tail, tail + 1, memory_order_release);
+  return sqe;
+}
 
-  UNUSED(sb);
-  UNUSED(s);
+typedef struct {
+  size_t file;
+  int fd;
+  size_t size;
+  String_Builder sb;
+} __load_slot;
+
+static inline void __uring_read(__uring *r, __load_slot *s, u64 slot) {
+  struct io_uring_sqe *sqe = __uring_sqe(r);
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = s->fd;
+  sqe->addr = (u64)(uintptr_t)(s->sb.items + s->sb.count);
+  sqe->len = MIN(s->size - s->sb.count, (size_t)INT32_MAX);
+  sqe->off = s->sb.count;
+  sqe->user_data = slot;
+}
 
-  return sp;
+static inline void __uring_open(__uring *r, __load_slot *s, const char *path,
+                                u64 slot) {
+  struct io_uring_sqe *sqe = __uring_sqe(r);
+  sqe->opcode = IORING_OP_OPENAT;
+  sqe->fd = AT_FDCWD;
+  sqe->addr = (u64)(uintptr_t)path;
+  sqe->open_flags = O_RDONLY | O_CLOEXEC;
+  sqe->user_data = slot;
+  s->fd = -1;
 }
 
-#define sb_split(sb, c)                                                        \
-  _Generic((c), int: _sb_split_char, char *: _sb_split_str)((sb), (c));
+static inline size_t __sb_read_files_uring(__uring *r, __load_job *job) {
+  __load_slot slots[__LOAD_DEPTH];
+  size_t free_slots[__LOAD_DEPTH], nfree = 0, inflight = 0;
+  for (size_t k = 0; k < __LOAD_DEPTH; ++k) {
+    free_slots[nfree++] = __LOAD_DEPTH - 1 - k;
+  }
 
-#define sb_foreach_line(sb, __l)                                               \
-  for ((__l) = strtok((sb)->items, "\n"); (__l); __l = strtok(NULL, "\n"))
+  u32 pending = 0;
+  while (job->next < job->n || inflight) {
+    while (nfree && job->next < job->n) {
+      size_t k = free_slots[--nfree];
+      slots[k] = (__load_slot){.file = job->next++};
+      __uring_open(r, &slots[k], job->paths[slots[k].file], k);
+      inflight++;
+      pending++;
+    }
 
-/* End: STRING BUILDER */
+    int ret = syscall(__NR_io_uring_enter, r->fd, pending, 1,
+                      IORING_ENTER_GETEVENTS, NULL, 0);
+    /* In-flight requests point into `slots`, there is no way to bail out */
+    assert((ret >= 0 || errno == EINTR) && "io_uring_enter failed");
+    pending -= ret > 0 ? (u32)ret : 0;
+
+    u32 head = atomic_load_explicit(r->cq_head, memory_order_relaxed);
+    while (head != atomic_load_explicit(r->cq_tail, memory_order_acquire)) {
+      struct io_uring_cqe *cqe = &r->cqes[head & r->cq_mask];
+      size_t k = cqe->user_data;
+      int res = cqe->res;
+      __load_slot *s = &slots[k];
+      head++;
+      atomic_store_explicit(r->cq_head, head, memory_order_release);
+
+      int err = 0;
+      bool done = false;
+      if (s->fd < 0) { /* Open completed */
+        struct stat st;
+        s->fd = res;
+        if (res < 0) {
+          err = -res;
+        } else if (fstat(s->fd, &st) < 0) {
+          err = errno;
+        } else {
+          s->size = st.st_size;
+          da_reserve(&s->sb, s->size + 1);
+        }
+        done = err || s->size == 0;
+      } else if (res == -EINTR || res == -EAGAIN) {
+        /* Transient, send the same read again */
+      } else if (res < 0) {
+        err = -res;
+        done = true;
+      } else {
+        s->sb.count += res;
+        done = res == 0 || s->sb.count == s->size;
+      }
+
+      if (!done) {
+        __uring_read(r, s, k);
+        pending++;
+        continue;
+      }
+      if (s->fd >= 0)
+        close(s->fd);
+      __load_deliver(job, s->file, s->sb, err);
+      free_slots[nfree++] = k;
+      inflight--;
+    }
+  }
+  return job->failed;
+}
+#endif // __PJ_IO_URING
+
+static inline size_t sb_read_files(const char **paths, size_t n,
+                                   String_Builder *out, sb_load_fn cb,
+                                   void *ctx) {
+#ifdef __PJ_IO_URING
+  __uring r;
+  if (n && __uring_init(&r, __LOAD_DEPTH)) {
+    __load_job job = {.paths = paths, .n = n, .out = out, .cb = cb, .ctx = ctx};
+    pthread_mutex_init(&job.lock, NULL);
+    size_t failed = __sb_read_files_uring(&r, &job);
+    __uring_free(&r);
+    pthread_mutex_destroy(&job.lock);
+    return failed;
+  }
+#endif // __PJ_IO_URING
+  return sb_read_files_pool(paths, n, out, cb, ctx);
+}
+
+/* End: Batch IO */
 
 /* Start: Linked List */
 typedef struct node {
@@ -812,6 +3977,12 @@ static inline void *__ht_get_v3(void *ht, Vector3 key, size_t key_offset,
     __n->value = Box(__v);                                                     \
     __n->next = (ht)->nodes[__i];                                              \
     (ht)->nodes[__i] = __n;                                                    \
+    __prof_probe({                                                             \
+      size_t __len = 0;                                                        \
+      for (typeof(__n) __c = __n; __c; __c = __c->next)                        \
+        __len++;                                                               \
+      prof_record("ht_chain", __len);                                          \
+    });                                                                        \
     da_append((ht), __n->key);                                                 \
   } while (0);
 
@@ -835,6 +4006,321 @@ static inline void *__ht_get_v3(void *ht, Vector3 key, size_t key_offset,
 
 /* End: Hash Table */
 
+/* Start: Snapshot */
+/*
+   Binary snapshots of dynamic arrays and hash tables that can be mapped back
+   read-only. All offsets in the file are relative to its start, so a mapped
+   snapshot is usable wherever it lands in memory.
+
+     header | DA: items
+            | HT: index (u32 per slot) | entries | string keys
+
+   Hash tables are stored as a flat open-addressing index with 2x as many
+   slots as keys. A slot holds 0 or entry number + 1; an entry is the value
+   padded to 8 bytes followed by the key bytes, or by {offset, length} into
+   the string section for char * keys. The writers stream the tables straight
+   from memory, the only scratch space is one pointer per index slot.
+
+   All functions return 0 or an errno; snap_open returns EINVAL for files
+   that are not snapshots or are truncated. A byte-swapped or differently
+   laid out snapshot fails the version check.
+*/
+#define SNAP_MAGIC "PJSNAP\r\n"
+#define SNAP_VERSION 1
+
+typedef enum { SNAP_DA = 1, SNAP_HT = 2 } Snap_Kind;
+
+typedef struct {
+  char magic[8];
+  u32 version;
+  u32 kind;
+  u32 key_size;   /* HT: bytes per key, 0 for char * keys */
+  u32 value_size; /* DA: bytes per item, HT: bytes per value */
+  u64 count;      /* items or distinct keys */
+  u64 slots;      /* HT: index slots, a power of two */
+  u64 index;
+  u64 entries;
+  u64 strings;
+  u64 size;
+} Snap_Header;
+
+typedef struct {
+  const u8 *base;
+  size_t size;
+  const Snap_Header *h;
+} Snapshot;
+
+#define __snap_align(x, a) (((x) + (a) - 1) & ~(u64)((a) - 1))
+
+/* FNV-1a, fixed so that snapshots do not depend on TABLE_SIZE or __hash */
+static inline u64 __snap_hash(const void *key, size_t len) {
+  const u8 *p = key;
+  u64 h = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < len; ++i)
+    h = (h ^ p[i]) * 0x100000001b3ULL;
+  return h;
+}
+
+static inline size_t __snap_entry_size(const Snap_Header *h) {
+  return __snap_align(h->value_size, 8) +
+         (h->key_size ? __snap_align(h->key_size, 8) : 2 * sizeof(u64));
+}
+
+static inline int __snap_finish(FILE *fp) {
+  int err = ferror(fp) ? EIO : 0;
+  if (fclose(fp) != 0 && !err)
+    err = errno;
+  return err;
+}
+
+static inline void __snap_pad(FILE *fp, u64 at, u64 to) {
+  static const u8 zero[64] = {0};
+  for (; at < to; at += MIN(to - at, sizeof(zero)))
+    fwrite(zero, 1, MIN(to - at, sizeof(zero)), fp);
+}
+
+static inline int __snap_write_da(const char *path, const void *items,
+                                  size_t count, size_t size) {
+  Snap_Header h = {.magic = SNAP_MAGIC, .version = SNAP_VERSION,
+                   .kind = SNAP_DA, .value_size = size, .count = count};
+  h.entries = __snap_align(sizeof(h), 64);
+  h.index = h.strings = h.entries + count * size;
+  h.size = h.strings;
+
+  FILE *fp = fopen(path, "wb");
+  if (fp == NULL)
+    return errno;
+  fwrite(&h, sizeof(h), 1, fp);
+  __snap_pad(fp, sizeof(h), h.entries);
+  if (count)
+    fwrite(items, size, count, fp);
+  return __snap_finish(fp);
+}
+
+#define snap_write_da(path, da)                                                \
+  __snap_write_da((path), (da)->items, (da)->count, __item_size((da)))
+
+static inline const void *__snap_node_key(const Snap_Header *h, void *node,
+                                          size_t key_offset, size_t *len) {
+  const void *key = *(void **)((size_t)node + key_offset);
+  *len = h->key_size ? h->key_size : strlen(key);
+  return key;
+}
+
+static inline int __snap_write_ht(const char *path, void *ht, size_t count,
+                                  size_t key_size, size_t value_size,
+                                  size_t nodes_offset, size_t key_offset,
+                                  size_t value_offset, size_t next_offset) {
+  Snap_Header h = {.magic = SNAP_MAGIC, .version = SNAP_VERSION,
+                   .kind = SNAP_HT, .key_size = key_size,
+                   .value_size = value_size, .slots = 8};
+  while (h.slots < 2 * count)
+    h.slots <<= 1;
+  void **tab = calloc(h.slots, sizeof(*tab));
+  if (tab == NULL)
+    return ENOMEM;
+
+  /* Chains hold the newest node first, that is the one ht_get returns */
+  void **nodes = (void **)((size_t)ht + nodes_offset);
+  u64 strings = 0;
+  for (size_t b = 0; b < TABLE_SIZE; ++b) {
+    for (void *n = nodes[b]; n; n = *(void **)((size_t)n + next_offset)) {
+      size_t len, olen;
+      const void *key = __snap_node_key(&h, n, key_offset, &len);
+      u64 i = __snap_hash(key, len) & (h.slots - 1);
+      for (; tab[i]; i = (i + 1) & (h.slots - 1)) {
+        const void *other = __snap_node_key(&h, tab[i], key_offset, &olen);
+        if (olen == len && memcmp(key, other, len) == 0)
+          break;
+      }
+      if (tab[i])
+        continue;
+      tab[i] = n;
+      h.count++;
+      strings += key_size ? 0 : len;
+    }
+  }
+
+  size_t esize = __snap_entry_size(&h);
+  h.index = __snap_align(sizeof(h), 64);
+  h.entries = __snap_align(h.index + h.slots * sizeof(u32), 64);
+  h.strings = h.entries + h.count * esize;
+  h.size = h.strings + strings;
+
+  FILE *fp = fopen(path, "wb");
+  if (fp == NULL) {
+    int err = errno;
+    free(tab);
+    return err;
+  }
+  fwrite(&h, sizeof(h), 1, fp);
+  __snap_pad(fp, sizeof(h), h.index);
+  u32 e = 0;
+  for (size_t i = 0; i < h.slots; ++i) {
+    u32 slot = tab[i] ? ++e : 0;
+    fwrite(&slot, sizeof(slot), 1, fp);
+  }
+  __snap_pad(fp, h.index + h.slots * sizeof(u32), h.entries);
+
+  u64 off = 0;
+  for (size_t i = 0; i < h.slots; ++i) {
+    if (!tab[i])
+      continue;
+    size_t len;
+    const void *key = __snap_node_key(&h, tab[i], key_offset, &len);
+    fwrite(*(void **)((size_t)tab[i] + value_offset), value_size, 1, fp);
+    __snap_pad(fp, value_size, __snap_align(value_size, 8));
+    if (key_size) {
+      fwrite(key, key_size, 1, fp);
+      __snap_pad(fp, key_size, __snap_align(key_size, 8));
+    } else {
+      u64 ref[2] = {off, len};
+      fwrite(ref, sizeof(ref), 1, fp);
+      off += len;
+    }
+  }
+  for (size_t i = 0; !key_size && i < h.slots; ++i) {
+    if (!tab[i])
+      continue;
+    size_t len;
+    const void *key = __snap_node_key(&h, tab[i], key_offset, &len);
+    fwrite(key, 1, len, fp);
+  }
+  free(tab);
+  return __snap_finish(fp);
+}
+
+#define __snap_key_size(k) _Generic((k), char *: 0, default: sizeof(*(k)))
+
+#define snap_write_ht(path, ht)                                                \
+  __snap_write_ht((path), (ht), (ht)->count,                                   \
+                  __snap_key_size((ht)->nodes[0]->key),                        \
+                  sizeof(*(ht)->nodes[0]->value),                              \
+                  offsetof(typeof(*(ht)), nodes),                              \
+                  offsetof(typeof(*(ht)->nodes[0]), key),                      \
+                  offsetof(typeof(*(ht)->nodes[0]), value),                    \
+                  offsetof(typeof(*(ht)->nodes[0]), next))
+
+static inline bool __snap_valid(const Snap_Header *h, size_t size) {
+  if (size < sizeof(*h) || memcmp(h->magic, SNAP_MAGIC, 8) != 0 ||
+      h->version != SNAP_VERSION || h->size != size || h->value_size == 0)
+    return false;
+  if (h->kind == SNAP_DA)
+    return h->entries <= size &&
+           h->count <= (size - h->entries) / h->value_size &&
+           h->entries + h->count * h->value_size <= size;
+  if (h->kind != SNAP_HT || h->slots == 0 || (h->slots & (h->slots - 1)) ||
+      h->count >= h->slots || h->slots > (size / sizeof(u32)))
+    return false;
+  return h->index <= size && h->index + h->slots * sizeof(u32) <= h->entries &&
+         h->entries <= size &&
+         h->count <= (size - h->entries) / __snap_entry_size(h) &&
+         h->entries + h->count * __snap_entry_size(h) <= h->strings &&
+         h->strings <= size;
+}
+
+static inline int snap_open(Snapshot *s, const char *path) {
+  *s = (Snapshot){0};
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return errno;
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    int err = errno;
+    close(fd);
+    return err;
+  }
+  if ((size_t)st.st_size < sizeof(Snap_Header)) {
+    close(fd);
+    return EINVAL;
+  }
+  void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  int err = p == MAP_FAILED ? errno : 0;
+  close(fd);
+  if (err)
+    return err;
+  if (!__snap_valid(p, st.st_size)) {
+    munmap(p, st.st_size);
+    return EINVAL;
+  }
+  *s = (Snapshot){.base = p, .size = st.st_size, .h = p};
+  return 0;
+}
+
+static inline void snap_close(Snapshot *s) {
+  if (s->base)
+    munmap((void *)s->base, s->size);
+  *s = (Snapshot){0};
+}
+
+#define snap_count(s) ((s)->h->count)
+
+/* Items of a dynamic array snapshot, NULL if it holds something else */
+static inline const void *__snap_da(const Snapshot *s, size_t size) {
+  if (s->h->kind != SNAP_DA || s->h->value_size != size)
+    return NULL;
+  return s->base + s->h->entries;
+}
+
+#define snap_da(s, type) ((const type *)__snap_da((s), sizeof(type)))
+
+static inline const void *__snap_find(const Snapshot *s, const void *key,
+                                      size_t len, size_t key_size,
+                                      size_t value_size) {
+  const Snap_Header *h = s->h;
+  if (h->kind != SNAP_HT || h->key_size != key_size ||
+      h->value_size != value_size)
+    return NULL;
+  const u32 *index = (const u32 *)(s->base + h->index);
+  size_t esize = __snap_entry_size(h), koff = __snap_align(h->value_size, 8);
+  /* A damaged index may have no empty slot left, so probe each slot once */
+  u64 i = __snap_hash(key, len) & (h->slots - 1);
+  for (u64 n = 0; n < h->slots && index[i]; ++n, i = (i + 1) & (h->slots - 1)) {
+    if (index[i] > h->count)
+      return NULL;
+    const u8 *e = s->base + h->entries + (index[i] - 1) * esize;
+    if (key_size) {
+      if (memcmp(e + koff, key, len) == 0)
+        return e;
+      continue;
+    }
+    const u64 *ref = (const u64 *)(e + koff);
+    if (ref[1] == len && ref[0] <= h->size - h->strings &&
+        len <= h->size - h->strings - ref[0] &&
+        memcmp(s->base + h->strings + ref[0], key, len) == 0)
+      return e;
+  }
+  return NULL;
+}
+
+static inline const void *__snap_get_str(const Snapshot *s, const char *key,
+                                         size_t value_size) {
+  return __snap_find(s, key, strlen(key), 0, value_size);
+}
+static inline const void *__snap_get(const Snapshot *s, u64 key,
+                                     size_t value_size) {
+  return __snap_find(s, &key, sizeof(key), sizeof(key), value_size);
+}
+static inline const void *__snap_get_v2(const Snapshot *s, Vector2 key,
+                                        size_t value_size) {
+  return __snap_find(s, &key, sizeof(key), sizeof(key), value_size);
+}
+static inline const void *__snap_get_v3(const Snapshot *s, Vector3 key,
+                                        size_t value_size) {
+  return __snap_find(s, &key, sizeof(key), sizeof(key), value_size);
+}
+
+/* Like ht_get: a pointer to the `type` value stored under k, or NULL if k is
+   absent or the snapshot holds keys or values of another size */
+#define snap_get(s, k, type)                                                   \
+  ((const type *)_Generic((k),                                                 \
+       char *: __snap_get_str,                                                 \
+       const char *: __snap_get_str,                                           \
+       Vector2: __snap_get_v2,                                                 \
+       Vector3: __snap_get_v3,                                                 \
+       default: __snap_get)((s), (k), sizeof(type)))
+/* End: Snapshot */
+
 /* Start: Temporary strings */
 #define format(fmt, ...) __format(fmt, __VA_ARGS__)
 
@@ -869,13 +4355,307 @@ static inline Grid __grid_read_fp(FILE *p) {
   return G;
 }
 
-static inline void grid_print(Grid *G) {
+/* Write the rows of G, one newline terminated line each */
+static inline void out_grid(Out *o, const Grid *G) {
+  struct iovec iov[__OUT_IOV + 1];
+  int n = 0;
   for (size_t y = 0; y < G->ny; ++y) {
-    for (size_t x = 0; x < G->nx; ++x) {
-      printf("%c", *ma_at(G, x, y));
+    iov[1 + n++] = (struct iovec){ma_at(G, 0, y), G->nx};
+    iov[1 + n++] = (struct iovec){(void *)"\n", 1};
+    if (n == __OUT_IOV || y + 1 == G->ny) {
+      __out_iov(o, iov + 1, n);
+      n = 0;
+    }
+  }
+}
+
+static inline void grid_print(Grid *G) { out_grid(out_stdout(), G); }
+
+/*
+   Grid traversal. Cells are addressed by their flat index y * nx + x and all
+   per-cell state (distances, labels, visited bits) lives in flat arrays of
+   that size. Distances and labels come back as a matrix of the grid's shape,
+   so ma_at works on them; unreached cells hold GRID_UNREACHED.
+
+   `nb` selects 4 (orthogonal) or 8 (orthogonal + diagonal) neighbours.
+*/
+#define GRID_UNREACHED (-1)
+
+typedef enum {
+  GRID_N4 = 4,
+  GRID_N8 = 8,
+} Grid_Neighbours;
+
+/* The orthogonal directions come first, so GRID_N4 is a prefix of GRID_N8 */
+static const Vector2 __grid_dirs[GRID_N8] = {
+    {1, 0}, {0, 1}, {-1, 0}, {0, -1}, {1, 1}, {-1, 1}, {-1, -1}, {1, -1},
+};
+
+typedef struct {
+  i64 *items;
+  size_t nx;
+  size_t ny;
+} Grid_Dist;
+
+da_decl(Grid_Path, Vector2)
+
+/* Can we step from a cell containing `from` to one containing `to`? */
+typedef bool (*Grid_Pass)(char from, char to);
+/* Cost of stepping from `from` to `to`, at least 1, 0 or negative if
+   impassable. Zero cost steps are not allowed: grid_path could not tell which
+   of two cells at the same distance it came from. */
+typedef i64 (*Grid_Cost)(char from, char to);
+
+static inline bool grid_pass_same(char from, char to) { return from == to; }
+static inline bool grid_pass_open(char from, char to) {
+  UNUSED(from);
+  return to != '#';
+}
+
+#define grid_index(G, v) ((size_t)(v).y * (G)->nx + (size_t)(v).x)
+
+static inline Grid_Dist __grid_dist_new(const Grid *G) {
+  Grid_Dist D = {.nx = G->nx, .ny = G->ny};
+  ma_init(&D);
+  for (size_t i = 0; i < D.nx * D.ny; ++i) {
+    D.items[i] = GRID_UNREACHED;
+  }
+  return D;
+}
+
+/* Flat index of the neighbour of (x, y) in direction d, false if off-grid */
+static inline bool __grid_step(const Grid *G, size_t x, size_t y, size_t d,
+                               size_t *j) {
+  ssize_t nx = (ssize_t)x + __grid_dirs[d].x, ny = (ssize_t)y + __grid_dirs[d].y;
+  if (!ma_inbounds(G, nx, ny))
+    return false;
+  *j = (size_t)ny * G->nx + (size_t)nx;
+  return true;
+}
+
+/* FIFO of cell indices, sized to a power of two >= the number of cells */
+typedef struct {
+  size_t *items;
+  size_t head;
+  size_t tail;
+  size_t mask;
+} __grid_ring;
+
+static inline __grid_ring __grid_ring_new(size_t n) {
+  size_t cap = 1;
+  while (cap < n)
+    cap <<= 1;
+  __grid_ring r = {.items = malloc(cap * sizeof(size_t)), .mask = cap - 1};
+  assert(r.items);
+  return r;
+}
+
+#define __grid_ring_push(r, i) ((r)->items[(r)->tail++ & (r)->mask] = (i))
+#define __grid_ring_pop(r) ((r)->items[(r)->head++ & (r)->mask])
+#define __grid_ring_empty(r) ((r)->head == (r)->tail)
+
+/* Number of steps from `start` to every cell reachable through `pass` */
+static inline Grid_Dist grid_bfs(const Grid *G, Vector2 start,
+                                 Grid_Neighbours nb, Grid_Pass pass) {
+  Grid_Dist D = __grid_dist_new(G);
+  if (!ma_inbounds(G, start.x, start.y))
+    return D;
+
+  __grid_ring q = __grid_ring_new(G->nx * G->ny);
+  size_t s = grid_index(G, start);
+  D.items[s] = 0;
+  __grid_ring_push(&q, s);
+  while (!__grid_ring_empty(&q)) {
+    size_t i = __grid_ring_pop(&q), j;
+    for (size_t d = 0; d < nb; ++d) {
+      if (!__grid_step(G, i % G->nx, i / G->nx, d, &j))
+        continue;
+      if (D.items[j] != GRID_UNREACHED || !pass(G->items[i], G->items[j]))
+        continue;
+      D.items[j] = D.items[i] + 1;
+      __grid_ring_push(&q, j);
+    }
+  }
+  free(q.items);
+  return D;
+}
+
+/* Replace the region of cells equal to the one at `start` with `c`. Returns
+ * the number of cells filled. */
+static inline size_t grid_flood_fill(Grid *G, Vector2 start, char c,
+                                     Grid_Neighbours nb) {
+  if (!ma_inbounds(G, start.x, start.y))
+    return 0;
+
+  Bitset seen = {0};
+  __grid_ring q = __grid_ring_new(G->nx * G->ny);
+  size_t s = grid_index(G, start), n = 0;
+  char old = G->items[s];
+  bs_set(&seen, s);
+  __grid_ring_push(&q, s);
+  while (!__grid_ring_empty(&q)) {
+    size_t i = __grid_ring_pop(&q), j;
+    G->items[i] = c;
+    n++;
+    for (size_t d = 0; d < nb; ++d) {
+      if (!__grid_step(G, i % G->nx, i / G->nx, d, &j))
+        continue;
+      if (bs_test(&seen, j) || G->items[j] != old)
+        continue;
+      bs_set(&seen, j);
+      __grid_ring_push(&q, j);
+    }
+  }
+  free(q.items);
+  bs_free(&seen);
+  return n;
+}
+
+/* Label every cell with the id of its connected component, cells being
+ * connected when `pass` allows a step between them. Returns the number of
+ * components, ids run from 0 to that number - 1. */
+static inline size_t grid_components(const Grid *G, Grid_Neighbours nb,
+                                     Grid_Pass pass, Grid_Dist *labels) {
+  *labels = __grid_dist_new(G);
+  __grid_ring q = __grid_ring_new(G->nx * G->ny);
+  size_t n = 0;
+  for (size_t s = 0; s < G->nx * G->ny; ++s) {
+    if (labels->items[s] != GRID_UNREACHED)
+      continue;
+
+    labels->items[s] = n;
+    __grid_ring_push(&q, s);
+    while (!__grid_ring_empty(&q)) {
+      size_t i = __grid_ring_pop(&q), j;
+      for (size_t d = 0; d < nb; ++d) {
+        if (!__grid_step(G, i % G->nx, i / G->nx, d, &j))
+          continue;
+        if (labels->items[j] != GRID_UNREACHED ||
+            !pass(G->items[i], G->items[j]))
+          continue;
+        labels->items[j] = n;
+        __grid_ring_push(&q, j);
+      }
+    }
+    n++;
+  }
+  free(q.items);
+  return n;
+}
+
+typedef struct {
+  i64 d;
+  size_t i;
+} __grid_qitem;
+
+#define __grid_qitem_less(a, b) ((a).d < (b).d)
+heap_decl_d(__grid_queue, __grid_qitem, __grid_qitem_less, 4)
+
+static inline i64 __grid_heuristic(const Grid *G, size_t i, Vector2 goal,
+                                   Grid_Neighbours nb) {
+  i64 dx = llabs((i64)(i % G->nx) - goal.x);
+  i64 dy = llabs((i64)(i / G->nx) - goal.y);
+  return nb == GRID_N4 ? dx + dy : MAX(dx, dy);
+}
+
+/* Shared by grid_dijkstra and grid_astar: stops once `goal` is settled,
+ * `goal` == NULL searches the whole grid without a heuristic. */
+static inline Grid_Dist __grid_search(const Grid *G, Vector2 start,
+                                      const Vector2 *goal, Grid_Neighbours nb,
+                                      Grid_Cost cost) {
+  Grid_Dist D = __grid_dist_new(G);
+  if (!ma_inbounds(G, start.x, start.y))
+    return D;
+
+  __grid_queue q = {0};
+  size_t s = grid_index(G, start);
+  size_t g = goal ? grid_index(G, *goal) : (size_t)-1;
+  D.items[s] = 0;
+  __grid_queue_push(
+      &q, (__grid_qitem){.d = goal ? __grid_heuristic(G, s, *goal, nb) : 0,
+                         .i = s});
+  while (q.count) {
+    __grid_qitem top = __grid_queue_pop(&q);
+    size_t i = top.i, j;
+    i64 h = goal ? __grid_heuristic(G, i, *goal, nb) : 0;
+    if (top.d - h > D.items[i])
+      continue; /* Stale entry */
+    if (i == g)
+      break;
+
+    for (size_t d = 0; d < nb; ++d) {
+      if (!__grid_step(G, i % G->nx, i / G->nx, d, &j))
+        continue;
+      i64 c = cost(G->items[i], G->items[j]);
+      if (c <= 0)
+        continue;
+      i64 nd = D.items[i] + c;
+      if (D.items[j] != GRID_UNREACHED && D.items[j] <= nd)
+        continue;
+      D.items[j] = nd;
+      h = goal ? __grid_heuristic(G, j, *goal, nb) : 0;
+      __grid_queue_push(&q, (__grid_qitem){.d = nd + h, .i = j});
+    }
+  }
+  __grid_queue_free(&q);
+  return D;
+}
+
+/* Cheapest cost from `start` to every reachable cell */
+static inline Grid_Dist grid_dijkstra(const Grid *G, Vector2 start,
+                                      Grid_Neighbours nb, Grid_Cost cost) {
+  return __grid_search(G, start, NULL, nb, cost);
+}
+
+/* Cheapest cost from `start` to `goal`, GRID_UNREACHED if there is no path.
+ * The heuristic assumes every step costs at least 1. If `dist` is given it
+ * receives the (partial) distance matrix, for use with grid_path. */
+static inline i64 grid_astar(const Grid *G, Vector2 start, Vector2 goal,
+                             Grid_Neighbours nb, Grid_Cost cost,
+                             Grid_Dist *dist) {
+  Grid_Dist D = __grid_search(G, start, &goal, nb, cost);
+  i64 d = ma_inbounds(G, goal.x, goal.y) ? D.items[grid_index(G, goal)]
+                                         : GRID_UNREACHED;
+  if (dist) {
+    *dist = D;
+  } else {
+    free(D.items);
+  }
+  return d;
+}
+
+/* Walk `D` back from `goal` to the cell at distance 0. `cost` must be the one
+ * the distances were computed with, NULL for unit steps (grid_bfs). The path
+ * includes both endpoints and is empty if `goal` was not reached. */
+static inline Grid_Path grid_path(const Grid *G, const Grid_Dist *D,
+                                  Vector2 goal, Grid_Neighbours nb,
+                                  Grid_Cost cost) {
+  Grid_Path path = {0};
+  if (!ma_inbounds(G, goal.x, goal.y) ||
+      D->items[grid_index(G, goal)] == GRID_UNREACHED)
+    return path;
+
+  size_t i = grid_index(G, goal), j;
+  da_append(&path, goal);
+  while (D->items[i] > 0) {
+    size_t d;
+    for (d = 0; d < nb; ++d) {
+      if (!__grid_step(G, i % G->nx, i / G->nx, d, &j) ||
+          D->items[j] == GRID_UNREACHED)
+        continue;
+      i64 c = cost ? cost(G->items[j], G->items[i]) : 1;
+      if (c > 0 && D->items[j] + c == D->items[i])
+        break;
     }
-    printf("\n");
+    assert(d < nb && "Inconsistent distances");
+    i = j;
+    da_append(&path, ((Vector2){.x = i % G->nx, .y = i / G->nx}));
+  }
+
+  for (size_t a = 0, b = path.count - 1; a < b; ++a, --b) {
+    swap(path.items[a], path.items[b]);
   }
+  return path;
 }
 /* End: Grid */
 #endif // _LIBPJ_H_
@@ -1,7 +1,12 @@
 #define __INIT_CAP 2
 #define UNIT_TEST
+#define BTREE_ORDER 4
+#define PJ_PROFILE
+#define PJ_PROFILE_PROBES
 #include "libpj.h"
 #include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
 #include <unistd.h>
 
 #define expect_op(a, o, b, fmt, ...)                                    \
@@ -23,6 +28,121 @@ expect_op((int)(a), ==, (int)(b), "lhs != rhs: lhs = %d, rhs = %d", (int)(a), (i
   } while (0);
 
 int double_it(int i) { return 2 * i; }
+coo_decl(Coo, int)
+csr_decl(Csr, int)
+
+da_soa_decl(Cloud, (float, x), (float, y), (int, id))
+
+#define int_less(a, b) ((a) < (b))
+heap_decl(IntHeap, int, int_less)
+
+typedef struct {
+  size_t id;
+  int prio;
+} Task;
+#define task_less(a, b) ((a).prio < (b).prio)
+#define task_id(t) ((t).id)
+heap_decl_indexed(TaskHeap, Task, task_less, 4, task_id)
+
+btree_decl(IntMap, int, u64, int_less)
+
+spsc_decl(IntSPSC, int)
+mpmc_decl(IntMPMC, int)
+#define RING_N 10000
+
+void *spsc_producer(void *arg) {
+  IntSPSC *q = arg;
+  int batch[] = {0, 1, 2, 3, 4, 5, 6, 7};
+  size_t done = 0;
+  while (done < ARRAY_LEN(batch)) {
+    done += IntSPSC_push_n(q, batch + done, ARRAY_LEN(batch) - done);
+    sched_yield();
+  }
+  for (int i = ARRAY_LEN(batch); i < RING_N;) {
+    if (IntSPSC_push(q, i)) {
+      i++;
+    } else {
+      sched_yield();
+    }
+  }
+  return NULL;
+}
+
+void *mpmc_producer(void *arg) {
+  for (int i = 1; i <= RING_N;) {
+    if (IntMPMC_push(arg, i)) {
+      i++;
+    } else {
+      sched_yield();
+    }
+  }
+  return NULL;
+}
+
+void *mpmc_consumer(void *arg) {
+  static _Atomic long sum = 0, seen = 0;
+  int x;
+  while (seen < 2 * RING_N) {
+    if (IntMPMC_pop(arg, &x)) {
+      sum += x;
+      seen++;
+    } else {
+      sched_yield();
+    }
+  }
+  return (void *)&sum;
+}
+
+void count_record(String_View rec, void *local, void *ctx) {
+  UNUSED(ctx);
+  u64 *counts = local, v;
+  counts[0]++;
+  if (rec.size > 0 && sv_parse_u64(rec, &v) == rec.size) {
+    counts[1] += v;
+  }
+}
+
+void split_record(String_View rec, void *local, void *ctx) {
+  UNUSED(ctx);
+  da_append((String_Split *)local, rec);
+}
+
+void load_file(size_t i, const char *path, String_Builder *sb, int err,
+               void *ctx) {
+  UNUSED(path);
+  size_t *sizes = ctx;
+  sizes[i] = err ? (size_t)-1 : sb->count;
+}
+
+i64 grid_cost(char from, char to) {
+  UNUSED(from);
+  return to == '#' ? -1 : to == '~' ? 5 : 1;
+}
+
+i64 grid_cost_free_water(char from, char to) {
+  return to == '~' ? 0 : grid_cost(from, to);
+}
+
+#define free_ht(ht)                                                            \
+  do {                                                                         \
+    for (size_t __b = 0; __b < TABLE_SIZE; ++__b) {                            \
+      for (typeof((ht)->nodes[0]) __n = (ht)->nodes[__b], __next; __n;         \
+           __n = __next) {                                                     \
+        __next = __n->next;                                                    \
+        free(__n->key);                                                        \
+        free(__n->value);                                                      \
+        free(__n);                                                             \
+      }                                                                        \
+    }                                                                          \
+    free((ht)->items);                                                         \
+    free((ht));                                                                \
+  } while (0)
+
+bool count_match(u64 pos, u32 id, void *ctx) {
+  UNUSED(pos);
+  ((size_t *)ctx)[id]++;
+  return true;
+}
 
 int main(void) {
   {  /* Dynamic Array */
@@ -48,6 +168,274 @@ int main(void) {
 
     da_map(&vec, double_it);
     da_foreach(&vec, i) { expect(2 * (int)__i == i); }
+
+    static int block[] = {10, 11, 12};
+    da_extend(&vec, block, ARRAY_LEN(block));
+    expect_int_eq(vec.count, 7);
+    expect_int_eq(vec.items[6], 12);
+
+    da_insert_n(&vec, 1, block, 2);
+    expect_int_eq(vec.count, 9);
+    expect(vec.items[0] == 0 && vec.items[1] == 10 && vec.items[3] == 2);
+
+    da_remove_range(&vec, 1, 2);
+    expect_int_eq(vec.count, 7);
+    expect_int_eq(vec.items[1], 2);
+
+    da_reserve(&vec, 100);
+    expect_int_eq(vec.count, 7);
+    expect(vec.capacity >= 100);
+    da_shrink_to_fit(&vec);
+    expect_int_eq(vec.capacity, 7);
+
+    da_resize(&vec, 10, -1);
+    expect(vec.count == 10 && vec.items[6] == 12 && vec.items[9] == -1);
+    da_resize(&vec, 2, 0);
+    expect_int_eq(vec.count, 2);
+
+    Vec exact = {0};
+    for (int j = 0; j < 5; ++j) {
+      da_append_with(&exact, j, da_growth_exact);
+    }
+    expect_int_eq(exact.capacity, 5);
+    da_extend_with(&exact, block, 3, da_growth_1_5);
+    expect_int_eq(exact.capacity, 10);
+    free(exact.items);
+
+    vec.count = 0;
+    da_shrink_to_fit(&vec);
+    expect(vec.items == NULL && vec.capacity == 0);
+  }
+
+  { /* Struct of Arrays */
+    Cloud pc = {0};
+    Cloud_row r;
+    for (int i = 0; i < 10; ++i) {
+      Cloud_append(&pc, (Cloud_row){.x = i, .y = -i, .id = 100 + i});
+    }
+    expect_int_eq(pc.count, 10);
+    expect(pc.capacity >= 10);
+    float sum = 0;
+    for (size_t i = 0; i < pc.count; ++i) {
+      sum += pc.x[i];
+    }
+    expect(sum == 45.0f);
+    expect(Cloud_get(&pc, 3).y == -3.0f);
+    Cloud_set(&pc, 3, (Cloud_row){.x = 0, .y = 0, .id = 0});
+    int n = 0;
+    da_soa_foreach(Cloud, &pc, r) { n += r.id; }
+    expect_int_eq(n, 1045 - 103);
+    Cloud_free(&pc);
+    expect(pc.x == NULL && pc.count == 0);
+  }
+
+  { /* Bitset */
+    Bitset bs = {0}, other = {0};
+    size_t i, n = 0;
+    bs_set(&bs, 3);
+    bs_set(&bs, 64);
+    bs_set(&bs, 1000);
+    expect(bs_test(&bs, 3) && bs_test(&bs, 64) && bs_test(&bs, 1000));
+    expect(!bs_test(&bs, 4) && !bs_test(&bs, 100000));
+    expect_int_eq(bs_popcount(&bs), 3);
+    expect_int_eq(bs_rank(&bs, 64), 1);
+    expect_int_eq(bs_rank(&bs, 65), 2);
+    expect_int_eq(bs_select(&bs, 2), 1000);
+    expect(bs_select(&bs, 3) == BS_NONE);
+
+    static size_t set[] = {3, 64, 1000};
+    bs_foreach(&bs, i) { expect_int_eq(i, set[n++]); }
+    expect_int_eq(n, 3);
+
+    bs_set(&other, 64);
+    bs_set(&other, 5000);
+    bs_or(&other, &bs);
+    expect_int_eq(bs_popcount(&other), 4);
+    bs_andnot(&other, &bs);
+    expect_int_eq(bs_select(&other, 0), 5000);
+    bs_xor(&other, &bs);
+    bs_and(&other, &bs);
+    expect_int_eq(bs_popcount(&other), 3);
+    bs_clear(&bs, 64);
+    expect(!bs_test(&bs, 64));
+    bs_free(&bs);
+    bs_free(&other);
+
+    Roaring rb = {0};
+    u64 x;
+    for (u32 v = 0; v < 10000; v += 2) {
+      rb_add(&rb, v);
+    }
+    rb_add(&rb, 1u << 20);
+    rb_add(&rb, 4);
+    expect_int_eq(rb_cardinality(&rb), 5001);
+    expect(rb.items[0].bitmap != NULL);
+    expect(rb_contains(&rb, 9998) && !rb_contains(&rb, 9999));
+    for (u32 v = 0; v < 4000; v += 2) {
+      rb_remove(&rb, v);
+    }
+    expect(rb.items[0].bitmap == NULL);
+    expect(!rb_contains(&rb, 10) && rb_contains(&rb, 4000));
+    n = 0;
+    rb_foreach(&rb, x) { n++; }
+    expect_int_eq(n, rb_cardinality(&rb));
+    expect(rb_next(&rb, 9999) == 1u << 20);
+
+    rb_to_bitset(&rb, &bs);
+    expect_int_eq(bs_popcount(&bs), rb_cardinality(&rb));
+    rb_free(&rb);
+    bs_free(&bs);
+  }
+
+  { /* Heap */
+    IntHeap h = {0};
+    static int vals[] = {5, 3, 9, 1, 7, 1, 8};
+    for (size_t i = 0; i < ARRAY_LEN(vals); ++i) {
+      IntHeap_push(&h, vals[i]);
+    }
+    expect_int_eq(IntHeap_peek(&h), 1);
+    int prev = IntHeap_pop(&h);
+    while (h.count) {
+      int next = IntHeap_pop(&h);
+      expect(prev <= next);
+      prev = next;
+    }
+
+    for (int i = 100; i > 0; --i) {
+      da_append(&h, i);
+    }
+    IntHeap_heapify(&h);
+    for (int i = 1; i <= 100; ++i) {
+      expect_int_eq(IntHeap_pop(&h), i);
+    }
+    IntHeap_free(&h);
+
+    TaskHeap th = {0};
+    for (size_t i = 0; i < 20; ++i) {
+      TaskHeap_push(&th, ((Task){.id = i, .prio = 100 + (int)i}));
+    }
+    TaskHeap_decrease_key(&th, ((Task){.id = 13, .prio = 1}));
+    TaskHeap_decrease_key(&th, ((Task){.id = 42, .prio = 2}));
+    expect(TaskHeap_contains(&th, 42) && !TaskHeap_contains(&th, 43));
+    expect_int_eq(TaskHeap_pop(&th).id, 13);
+    expect_int_eq(TaskHeap_pop(&th).id, 42);
+    expect(!TaskHeap_contains(&th, 13));
+    expect_int_eq(TaskHeap_pop(&th).id, 0);
+    /* A larger key sinks instead of breaking the order */
+    TaskHeap_decrease_key(&th, ((Task){.id = 1, .prio = 500}));
+    expect_int_eq(TaskHeap_pop(&th).id, 2);
+    expect_int_eq(th.count, 17);
+    TaskHeap_free(&th);
+  }
+
+  { /* B-Tree */
+    enum { KEYS = 2000 };
+    static u64 ref[KEYS];
+    IntMap m = {0};
+    srand(39);
+    for (int i = 0; i < 20000; ++i) {
+      int k = rand() % KEYS;
+      if (rand() % 3) {
+        expect(IntMap_insert(&m, k, (u64)i + 1) == !ref[k]);
+        ref[k] = i + 1;
+      } else {
+        expect(IntMap_erase(&m, k) == !!ref[k]);
+        ref[k] = 0;
+      }
+    }
+    size_t n = 0;
+    int prev = -1;
+    btree_foreach(IntMap, &m, it) {
+      expect(btree_key(it) > prev && ref[btree_key(it)] == btree_value(it));
+      prev = btree_key(it);
+      n++;
+    }
+    expect_int_eq(n, m.count);
+    for (int k = 0; k < KEYS; ++k) {
+      u64 *v = IntMap_find(&m, k);
+      expect(ref[k] ? v && *v == ref[k] : v == NULL);
+    }
+
+    n = 0;
+    btree_foreach_range(IntMap, &m, 500, 999, it) {
+      expect(btree_key(it) >= 500 && btree_key(it) <= 999);
+      n++;
+    }
+    size_t want = 0;
+    for (int k = 500; k <= 999; ++k) {
+      want += ref[k] != 0;
+    }
+    expect_int_eq(n, want);
+    n = 0;
+    btree_foreach_range(IntMap, &m, 999, 500, it) {
+      n++;
+    }
+    expect_int_eq(n, 0);
+    IntMap_iter lb = IntMap_lower_bound(&m, KEYS);
+    expect(lb.node == NULL);
+
+    for (int k = 0; k < KEYS; ++k) {
+      IntMap_erase(&m, k);
+    }
+    expect(m.root == NULL && m.count == 0);
+
+    da_decl(IntMapEntries, IntMap_entry);
+    IntMapEntries es = {0};
+    for (int k = 0; k < 1000; ++k) {
+      da_append(&es, ((IntMap_entry){k * 2, (u64)k}));
+    }
+    btree_load_da(IntMap, &m, &es);
+    expect_int_eq(m.count, 1000);
+    expect(*IntMap_find(&m, 998) == 499);
+    expect(IntMap_find(&m, 999) == NULL);
+    IntMap_iter ub = IntMap_upper_bound(&m, 999);
+    expect_int_eq(btree_key(ub), 1000);
+    expect(IntMap_insert(&m, 999, 7));
+    expect(IntMap_erase(&m, 0) && IntMap_erase(&m, 1998));
+    ub = IntMap_upper_bound(&m, 998);
+    expect_int_eq(btree_key(ub), 999);
+    expect_int_eq(btree_key(IntMap_begin(&m)), 2);
+    IntMap_free(&m);
+    free(es.items);
+  }
+
+  { /* Ring Buffer */
+    IntSPSC q;
+    IntSPSC_init(&q, 100);
+    expect_int_eq(q.mask + 1, 128);
+    pthread_t t;
+    pthread_create(&t, NULL, spsc_producer, &q);
+    int x, buf[16], next = 0;
+    while (next < RING_N) {
+      size_t n = IntSPSC_pop_n(&q, buf, ARRAY_LEN(buf));
+      for (size_t i = 0; i < n; ++i) {
+        expect_int_eq(buf[i], next++);
+      }
+      if (IntSPSC_pop(&q, &x)) {
+        expect_int_eq(x, next++);
+      } else if (!n) {
+        sched_yield();
+      }
+    }
+    pthread_join(t, NULL);
+    expect(!IntSPSC_pop(&q, &x));
+    IntSPSC_free(&q);
+
+    IntMPMC mq;
+    IntMPMC_init(&mq, 4);
+    expect_int_eq(IntMPMC_push_n(&mq, buf, ARRAY_LEN(buf)), 4);
+    expect_int_eq(IntMPMC_pop_n(&mq, buf, ARRAY_LEN(buf)), 4);
+    pthread_t ts[4];
+    void *sum;
+    pthread_create(&ts[0], NULL, mpmc_producer, &mq);
+    pthread_create(&ts[1], NULL, mpmc_producer, &mq);
+    pthread_create(&ts[2], NULL, mpmc_consumer, &mq);
+    pthread_create(&ts[3], NULL, mpmc_consumer, &mq);
+    for (size_t i = 0; i < ARRAY_LEN(ts); ++i) {
+      pthread_join(ts[i], &sum);
+    }
+    expect(*(_Atomic long *)sum == (long)RING_N * (RING_N + 1));
+    IntMPMC_free(&mq);
   }
 
   { /* Linear Algebra */
@@ -68,6 +456,179 @@ int main(void) {
         }
       }
     }
+
+    typedef struct {
+      float *items;
+      size_t n;
+    } VecF;
+    typedef struct {
+      int *items;
+      size_t n;
+    } VecI;
+
+    VecF a = {.n = 19}, b = {.n = 19};
+    v_init(&a);
+    v_init(&b);
+    v_fill(&a, 1.5f);
+    for (size_t i = 0; i < b.n; ++i) {
+      b.items[i] = i;
+    }
+    expect(a.items[18] == 1.5f);
+    expect(v_sum(&b) == 171.0f);
+    expect(v_dot(&a, &b) == 256.5f);
+    v_axpy(&a, 2.0f, &b);
+    expect(a.items[10] == 21.5f);
+    v_sub(&a, &a, &b);
+    v_sub(&a, &a, &b);
+    expect(v_max(&a) == 1.5f && v_min(&a) == 1.5f);
+    v_scale(&b, -1.0f);
+    expect(v_norm1(&b) == 171.0f);
+    expect(v_min(&b) == -18.0f && v_argmax(&b) == 0);
+    b.items[7] = 3.0f;
+    expect_int_eq(v_argmax(&b), 7);
+    b.items[0] = b.items[12] = NAN;
+    expect_int_eq(v_argmax(&b), 7);
+    v_mul(&a, &a, &a);
+    v_add(&a, &a, &a);
+    expect(a.items[0] == 4.5f);
+
+    VecI v = {.n = 5};
+    v_init(&v);
+    v_fill(&v, 300);
+    expect_int_eq(v.items[4], 300);
+    expect_int_eq(v_sum(&v), 1500);
+    v.items[2] = -4;
+    expect(v_norm2(&v) == sqrt(4 * 90000 + 16));
+    expect_int_eq(v_argmax(&v), 0);
+
+    /* Long enough for the AVX2 lanes plus a scalar tail */
+    VecI p = {.n = 21}, q = {.n = 21};
+    v_init(&p);
+    v_init(&q);
+    for (size_t i = 0; i < p.n; ++i) {
+      p.items[i] = i;
+      q.items[i] = 100 - 3 * (int)i;
+    }
+    v_add(&q, &q, &p);
+    v_mul(&q, &q, &p);
+    v_sub(&q, &q, &p);
+    v_scale(&q, 2);
+    v_axpy(&q, -1, &p);
+    for (size_t i = 0; i < p.n; ++i) {
+      int want = 2 * ((100 - 2 * (int)i) * (int)i - (int)i) - (int)i;
+      expect_int_eq(q.items[i], want);
+    }
+    expect_int_eq(v_max(&q), 2340);
+    expect_int_eq(v_min(&q), 0);
+    expect_int_eq(v_dot(&p, &p), 2870);
+    free(p.items);
+    free(q.items);
+
+    Matrix fm = {.nx = 3, .ny = 2};
+    ma_fill(&fm, 1000);
+    expect_int_eq(*ma_at(&fm, 2, 1), 1000);
+
+    /* | 1 0 2 |
+       | 0 0 0 |
+       | 0 3 0 |
+       | 4 0 5 | */
+    Coo coo = {.nx = 3, .ny = 4};
+    coo_push(&coo, 2, 3, 5);
+    coo_push(&coo, 0, 0, 1);
+    coo_push(&coo, 1, 2, 3);
+    coo_push(&coo, 0, 3, 4);
+    coo_push(&coo, 2, 0, 2);
+    Csr A = {0}, At = {0};
+    csr_from_coo(&A, &coo);
+    expect(A.nnz == 5 && A.rows[1] == 2 && A.rows[2] == 2 && A.rows[4] == 5);
+
+    VecI x = {.n = 3}, y = {0};
+    v_init(&x);
+    x.items[0] = 1, x.items[1] = 10, x.items[2] = 100;
+    csr_mulv(&A, &x, &y);
+    expect_int_eq(y.n, 4);
+    expect(y.items[0] == 201 && y.items[1] == 0 && y.items[2] == 30 &&
+           y.items[3] == 504);
+
+    csr_transpose(&At, &A);
+    expect(At.nx == 4 && At.ny == 3 && At.rows[1] == 2);
+    expect(At.cols[0] == 0 && At.cols[1] == 3 && At.items[1] == 4);
+
+    Matrix B = {.nx = 2, .ny = 3}, C = {0};
+    ma_fill(&B, 1);
+    *ma_at(&B, 1, 2) = 10;
+    csr_mul_dense(&A, &B, &C);
+    expect(C.nx == 2 && C.ny == 4);
+    expect(*ma_at(&C, 0, 0) == 3 && *ma_at(&C, 1, 0) == 21);
+    expect(*ma_at(&C, 0, 3) == 9 && *ma_at(&C, 1, 3) == 54);
+
+    /* Reuse outputs of a smaller product */
+    VecI w = {.n = 4}, z = {0};
+    v_init(&w);
+    v_fill(&w, 1);
+    csr_mulv(&At, &w, &z);
+    expect(z.n == 3 && z.items[0] == 5 && z.items[2] == 7);
+    csr_mulv(&A, &x, &z);
+    expect(z.n == 4 && z.items[3] == 504);
+    Matrix E = {.nx = 1, .ny = 4}, F = {0};
+    ma_fill(&E, 1);
+    csr_mul_dense(&At, &E, &F);
+    expect(F.nx == 1 && F.ny == 3 && *ma_at(&F, 0, 1) == 3);
+    csr_mul_dense(&A, &B, &F);
+    expect(F.nx == 2 && F.ny == 4 && *ma_at(&F, 1, 3) == 54);
+    free(w.items);
+    free(z.items);
+    free(E.items);
+    free(F.items);
+    csr_free(&A);
+    csr_free(&At);
+  }
+
+  { /* Grid */
+    char cells[] = "..#.."
+                   "..#.."
+                   "..~.."
+                   "###.#"
+                   "....#";
+    Grid G = {.items = cells, .nx = 5, .ny = 5};
+    Vector2 start = {0, 0}, goal = {4, 0};
+
+    Grid_Dist D = grid_bfs(&G, start, GRID_N4, grid_pass_open);
+    expect_int_eq(*ma_at(&D, 4, 0), 8);
+    expect_int_eq(*ma_at(&D, 0, 4), 10);
+    expect_int_eq(*ma_at(&D, 0, 3), GRID_UNREACHED);
+    Grid_Path path = grid_path(&G, &D, goal, GRID_N4, NULL);
+    expect_int_eq(path.count, 9);
+    expect(path.items[0].x == 0 && path.items[8].x == 4);
+    free(D.items);
+
+    D = grid_bfs(&G, start, GRID_N8, grid_pass_open);
+    expect_int_eq(*ma_at(&D, 0, 4), 6);
+    free(D.items);
+
+    D = grid_dijkstra(&G, start, GRID_N4, grid_cost);
+    expect_int_eq(*ma_at(&D, 4, 0), 12);
+    free(D.items);
+
+    expect_int_eq(grid_astar(&G, start, goal, GRID_N4, grid_cost, &D), 12);
+    path = grid_path(&G, &D, goal, GRID_N4, grid_cost);
+    expect_int_eq(path.count, 9);
+    free(D.items);
+    expect_int_eq(grid_astar(&G, start, (Vector2){0, 3}, GRID_N4, grid_cost,
+                             NULL),
+                  GRID_UNREACHED);
+    /* Zero cost steps are treated as impassable, walling off the start */
+    expect_int_eq(grid_astar(&G, start, goal, GRID_N4, grid_cost_free_water,
+                             NULL),
+                  GRID_UNREACHED);
+
+    expect_int_eq(grid_components(&G, GRID_N4, grid_pass_same, &D), 6);
+    expect_int_eq(*ma_at(&D, 4, 0), *ma_at(&D, 0, 4));
+    expect(*ma_at(&D, 0, 0) != *ma_at(&D, 4, 0));
+    free(D.items);
+
+    expect_int_eq(grid_flood_fill(&G, (Vector2){0, 3}, 'x', GRID_N4), 3);
+    expect(*ma_at(&G, 2, 3) == 'x' && *ma_at(&G, 2, 1) == '#');
   }
 
   { /* String Builder */
@@ -96,6 +657,139 @@ int main(void) {
     close(fd);
   }
 
+  { /* Batch IO */
+    char dir[] = "/tmp/libpj_test_XXXXXX";
+    expect(mkdtemp(dir) != NULL);
+    enum { NFILES = 200 };
+    char *paths[NFILES + 1];
+    for (size_t i = 0; i < NFILES; ++i) {
+      paths[i] = strdup(format("%s/%zu", dir, i));
+      FILE *fp = fopen(paths[i], "w");
+      for (size_t j = 0; j < i * 37; ++j) {
+        fputc('a' + j % 26, fp);
+      }
+      fclose(fp);
+    }
+    paths[NFILES] = strdup(format("%s/missing", dir));
+
+    String_Builder out[NFILES + 1] = {0};
+    size_t sizes[NFILES + 1];
+    expect_int_eq(sb_read_files((const char **)paths, NFILES + 1, out,
+                                load_file, sizes),
+                  1);
+    for (size_t i = 0; i < NFILES; ++i) {
+      expect_int_eq(out[i].count, i * 37);
+      expect_int_eq(sizes[i], i * 37);
+    }
+    expect(sizes[NFILES] == (size_t)-1);
+    expect(NFILES > 100 && out[100].items[27] == 'b');
+
+    /* A directory opens fine but fails to read */
+    const char *mixed[] = {dir, paths[1]};
+    expect_int_eq(sb_read_files(mixed, 2, NULL, load_file, sizes), 1);
+    expect(sizes[0] == (size_t)-1);
+    expect_int_eq(sizes[1], 37);
+
+    memset(sizes, 0, sizeof(sizes));
+    expect_int_eq(sb_read_files_pool((const char **)paths, NFILES + 1, NULL,
+                                     load_file, sizes),
+                  1);
+    for (size_t i = 0; i < NFILES; ++i) {
+      expect_int_eq(sizes[i], i * 37);
+      free(out[i].items);
+      unlink(paths[i]);
+      free(paths[i]);
+    }
+    free(out[NFILES].items);
+    free(paths[NFILES]);
+    rmdir(dir);
+  }
+
+  { /* Output */
+    char path[] = "/tmp/libpj_out_XXXXXX";
+    int fd = mkstemp(path);
+    expect(fd >= 0);
+    Grid G = {.nx = 300, .ny = 500};
+    ma_init(&G);
+    for (size_t i = 0; i < G.nx * G.ny; ++i) {
+      G.items[i] = 'a' + i % 26;
+    }
+
+    String_Builder want = {0};
+    Out o = out_fd(fd);
+    for (int i = 0; i < 1000; ++i) {
+      out_printf(&o, "%d,", i);
+      char num[16];
+      da_extend(&want, num, (size_t)snprintf(num, sizeof(num), "%d,", i));
+    }
+    out_puts(&o, "\n");
+    da_append(&want, '\n');
+    size_t grid_at = want.count;
+    out_grid(&o, &G);
+    for (size_t y = 0; y < G.ny; ++y) {
+      da_extend(&want, ma_at(&G, 0, y), G.nx);
+      da_append(&want, '\n');
+    }
+    char big[OUT_BUFSIZE + 10];
+    memset(big, 'z', sizeof(big));
+    out_write(&o, big, sizeof(big));
+    da_extend(&want, big, sizeof(big));
+    struct iovec iov[] = {{"ab", 2}, {"cd", 2}};
+    out_writev(&o, iov, 2);
+    out_sv(&o, ((String_View){"ef", 2}));
+    da_extend(&want, "abcdef", 6);
+    expect_int_eq(out_close(&o), 0);
+    close(fd);
+
+    String_Builder got = {0};
+    sb_read_file(&got, path);
+    expect_int_eq(got.count, want.count);
+    expect(memcmp(got.items, want.items, want.count) == 0);
+
+    FILE *fp = fopen(path, "w");
+    o = out_file(fp);
+    out_grid(&o, &G);
+    out_write(&o, big, sizeof(big));
+    expect_int_eq(out_close(&o), 0);
+    fclose(fp);
+    got.count = 0;
+    sb_read_file(&got, path);
+    expect_int_eq(got.count, G.ny * (G.nx + 1) + sizeof(big));
+    expect(memcmp(got.items, want.items + grid_at, got.count) == 0);
+
+    o = out_fd(-1);
+    out_write(&o, big, sizeof(big));
+    expect_int_eq(out_close(&o), EBADF);
+
+    /* print, println and grid_print stay in order with printf */
+    fflush(stdout);
+    fd = open(path, O_WRONLY | O_TRUNC);
+    int saved = dup(STDOUT_FILENO);
+    dup2(fd, STDOUT_FILENO);
+    close(fd);
+    int printed = println("first %d", 1);
+    printf("second\n");
+    print(3);
+    print("four");
+    char cells[] = "abcd";
+    Grid small = {.items = cells, .nx = 2, .ny = 2};
+    grid_print(&small);
+    printf("end\n");
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+    expect_int_eq(printed, 8);
+    got.count = 0;
+    sb_read_file(&got, path);
+    const char *order = "first 1\nsecond\n3\nfour\nab\ncd\nend\n";
+    expect_int_eq(got.count, strlen(order));
+    expect(memcmp(got.items, order, got.count) == 0);
+    unlink(path);
+    free(G.items);
+    free(want.items);
+    free(got.items);
+  }
+
   { /* String View */
     String_Builder sb = {0};
 
@@ -111,6 +805,196 @@ int main(void) {
     expect(strncmp(sv_to_sb(sv).items, "World", 5) == 0);
   }
 
+  { /* Multi-pattern search */
+    static char text[20000];
+    srand(41);
+    for (size_t i = 0; i < sizeof(text); ++i) {
+      text[i] = "abcde"[rand() % 5];
+    }
+    String_View sv = {text, sizeof(text)};
+    static char pats[100][8];
+    String_View ps[100];
+    size_t sizes[] = {5, 20, 100};
+    for (size_t k = 0; k < ARRAY_LEN(sizes); ++k) {
+      size_t np = sizes[k];
+      for (size_t p = 0; p < np; ++p) {
+        size_t len = 1 + p % 6 + (np > 5);
+        for (size_t i = 0; i < len; ++i) {
+          pats[p][i] = "abcdef"[rand() % 6];
+        }
+        ps[p] = (String_View){pats[p], len};
+      }
+      Matcher m = matcher_build_sv(ps, np);
+      Matches all = {0};
+      matcher_find_all(&m, sv, &all);
+      size_t want = 0;
+      for (size_t p = 0; p < np; ++p) {
+        for (size_t i = 0; i + ps[p].size <= sv.size; ++i) {
+          want += memcmp(text + i, ps[p].buf, ps[p].size) == 0;
+        }
+      }
+      expect_int_eq(all.count, want);
+      for (size_t i = 0; i < all.count; ++i) {
+        Match mt = all.items[i];
+        expect(memcmp(text + mt.pos, ps[mt.id].buf, ps[mt.id].size) == 0);
+        Match prev = all.items[i ? i - 1 : 0];
+        expect(mt.pos + ps[mt.id].size >= prev.pos + ps[prev.id].size);
+      }
+
+      Match_State st = {0};
+      size_t counts[100] = {0}, total = 0;
+      for (size_t at = 0, step = 1; at < sv.size;
+           at += step, step = step * 3 % 97) {
+        String_View chunk = {text + at, MIN(step, sv.size - at)};
+        matcher_feed(&m, &st, chunk, count_match, counts);
+      }
+      for (size_t p = 0; p < np; ++p) {
+        total += counts[p];
+      }
+      expect_int_eq(total, want);
+      matcher_free(&m);
+      free(all.items);
+    }
+
+    const char *words[] = {"warn", "error", "fatal", "err"};
+    Matcher m = matcher_build(words, 4);
+    String_Builder log = {0};
+    sb_append(&log, "ok ok info: fatal error, then a warning");
+    u32 id;
+    String_View at = sb_find_any(&log, &m, &id);
+    expect_int_eq(id, 2);
+    expect(at.buf == log.items + 12);
+    Matches all = {0};
+    matcher_find_all(&m, (String_View){log.items, log.count}, &all);
+    expect_int_eq(all.count, 4);
+    expect_int_eq(all.items[1].id, 3);
+    expect_int_eq(all.items[2].id, 1);
+    matcher_free(&m);
+    free(all.items);
+
+    all = (Matches){0};
+    m = matcher_build_sv(NULL, 0);
+    matcher_find_all(&m, (String_View){log.items, log.count}, &all);
+    expect_int_eq(all.count, 0);
+    expect(sb_find_any(&log, &m, &id).buf == NULL);
+    matcher_free(&m);
+    free(all.items);
+    free(log.items);
+  }
+
+  { /* Tokenizer */
+    const Char_Classes *ascii = cc_ascii();
+    for (int b = 0; b < 256; ++b) {
+      int want = isalnum(b)   ? CC_WORD
+                 : isspace(b) ? CC_SPACE
+                 : ispunct(b) ? CC_PUNCT
+                              : CC_OTHER;
+      expect_int_eq(ascii->cls[b], b < 128 ? want : CC_OTHER);
+    }
+
+    static char text[5000];
+    srand(42);
+    for (size_t i = 0; i < sizeof(text); ++i) {
+      int r = rand() % 100;
+      text[i] = r < 60 ? 'a' + r % 26 : r < 75 ? ' ' : r < 85 ? ",.;!"[r % 4]
+                : r < 95 ? '0' + r % 10 : 128 + rand() % 128;
+    }
+    Tokenizer t = tok_init(ascii, (String_View){text, sizeof(text)},
+                           CC_BIT(CC_SPACE), CC_BIT(CC_PUNCT));
+    size_t at = 0, ntok = 0;
+    tok_foreach(&t, tok) {
+      while (isspace((u8)text[at])) {
+        at++;
+      }
+      expect_int_eq(tok.text.buf - text, at);
+      size_t end = at + 1;
+      while (tok.cls != CC_PUNCT && end < sizeof(text) &&
+             ascii->cls[(u8)text[end]] == tok.cls) {
+        end++;
+      }
+      expect_int_eq(tok.text.size, end - at);
+      at = end;
+      ntok++;
+    }
+    expect(ntok > 500);
+    expect_int_eq(t.rest.size, 0);
+
+    Char_Classes cc = *ascii;
+    cc_set(&cc, "_", CC_WORD);
+    cc_set(&cc, "#", CC_CUSTOM);
+    const char *src = "snake_case ##tag, x";
+    t = tok_init(&cc, (String_View){src, strlen(src)}, CC_BIT(CC_SPACE), 0);
+    Token tok;
+    expect(tok_next(&t, &tok) && tok.text.size == 10);
+    expect(tok_next(&t, &tok) && tok.cls == CC_CUSTOM && tok.text.size == 2);
+    expect(tok_next(&t, &tok) && tok.cls == CC_WORD && tok.text.size == 3);
+    expect(tok_next(&t, &tok) && tok.cls == CC_PUNCT);
+    expect(tok_next(&t, &tok) && tok.text.buf[0] == 'x');
+    expect(!tok_next(&t, &tok));
+
+    String_View sv = {"hello big  world", 16};
+    String_View w = sv_get_words(&sv, 2);
+    expect_int_eq(w.size, 9);
+    expect(sv.buf[0] == 'w');
+
+    String_Builder sb = {0};
+    sb_append(&sb, "one two three");
+    char *orig = sb.items;
+    char *two = sb_get_words(&sb, 2);
+    expect_str_eq(two, "one two");
+    expect_str_eq(sb.items, "three");
+    free(two);
+    free(orig);
+  }
+
+  { /* Number Parsing */
+    u64 u;
+    i64 n;
+    double d;
+#define SV(s) ((String_View){.buf = (s), .size = strlen(s)})
+    expect_int_eq(sv_parse_u64(SV("1234567890123,"), &u), 13);
+    expect(u == 1234567890123llu);
+    expect_int_eq(sv_parse_u64(SV("18446744073709551615"), &u), 20);
+    expect(u == UINT64_MAX);
+    expect_int_eq(sv_parse_u64(SV("18446744073709551616"), &u), 0);
+    expect_int_eq(sv_parse_u64(SV("x1"), &u), 0);
+
+    expect_int_eq(sv_parse_i64(SV("-9223372036854775808 "), &n), 20);
+    expect(n == INT64_MIN);
+    expect_int_eq(sv_parse_i64(SV("9223372036854775808"), &n), 0);
+    expect_int_eq(sv_parse_i64(SV("+42"), &n), 3);
+    expect(n == 42);
+    expect_int_eq(sv_parse_i64(SV("-"), &n), 0);
+
+    expect_int_eq(sv_parse_f64(SV("3.14;"), &d), 4);
+    expect(d == 3.14);
+    expect_int_eq(sv_parse_f64(SV("-12.5e3"), &d), 7);
+    expect(d == -12500.0);
+    expect_int_eq(sv_parse_f64(SV(".5e"), &d), 2);
+    expect(d == 0.5);
+    expect_int_eq(sv_parse_f64(SV("1."), &d), 2);
+    expect(d == 1.0);
+    expect_int_eq(sv_parse_f64(SV("1.7976931348623157e308"), &d), 22);
+    expect(d == 1.7976931348623157e308);
+    expect_int_eq(sv_parse_f64(SV("0.1234567890123456789012"), &d), 24);
+    expect(d == 0.1234567890123456789012);
+    expect_int_eq(sv_parse_f64(SV("e5"), &d), 0);
+    expect_int_eq(sv_parse_f64(SV("."), &d), 0);
+
+    /* 2^53 + 1 is halfway between two doubles, a non-zero digit far past the
+       first 768 must still round it up */
+    static char longnum[1000];
+    size_t ln = sprintf(longnum, "9007199254740993.");
+    memset(longnum + ln, '0', 900);
+    ln += 900;
+    expect_int_eq(sv_parse_f64((String_View){longnum, ln}, &d), ln);
+    expect(d == 9007199254740992.0);
+    longnum[ln++] = '1';
+    expect_int_eq(sv_parse_f64((String_View){longnum, ln}, &d), ln);
+    expect(d == 9007199254740994.0);
+#undef SV
+  }
+
   { /* String Split */
     String_Builder sb = {0};
 
@@ -124,9 +1008,48 @@ int main(void) {
     }
   }
 
+  { /* Parallel */
+    String_Builder sb = {0};
+    for (int i = 0; i < 50000; ++i) {
+      sb_appendf(&sb, "%d\n", i);
+    }
+    sb.count--; /* Trailing '\0' */
+
+    u64 counts[2];
+    Parallel_Foreach pf = {
+        .record = count_record,
+        .merge = par_merge_counters,
+        .local_size = sizeof(counts),
+        .nthreads = 4,
+    };
+    sb_parallel_foreach(&sb, &pf, counts);
+    expect(counts[0] == 50000 && counts[1] == 50000llu * 49999 / 2);
+
+    String_Split sp;
+    pf = (Parallel_Foreach){
+        .record = split_record,
+        .merge = par_merge_split,
+        .local_size = sizeof(sp),
+        .nthreads = 3,
+        .delim = '\n',
+    };
+    sb_parallel_foreach(&sb, &pf, &sp);
+    expect_int_eq(sp.count, 50000);
+    u64 v;
+    for (size_t i = 0; i < sp.count; ++i) {
+      expect(sv_parse_u64(sp.items[i], &v) && v == i);
+    }
+    free(sp.items);
+
+    sb.count = 0;
+    sb_parallel_foreach(&sb, &pf, &sp);
+    expect_int_eq(sp.count, 0);
+    free(sb.items);
+  }
+
   { /* Format */
     expect_str_eq(format("%d %c %s %f", 42, 'd', "Hello, World!", 3.14),
-                  "42 d Hello, World! 3.14000");
+                  "42 d Hello, World! 3.140000");
   }
 
   { /* Linked List */
@@ -171,4 +1094,113 @@ int main(void) {
     struct Struct *bs = Box(s);
     expect(memcmp(bs, &s, sizeof(*bs)) == 0);
   }
+
+  { /* Snapshot */
+    char path[] = "/tmp/libpj_snap_XXXXXX";
+    int fd = mkstemp(path);
+    expect(fd >= 0);
+    close(fd);
+
+    Grid_Path pts = {0};
+    for (ssize_t i = 0; i < 1000; ++i) {
+      da_append(&pts, ((Vector2){i, -i}));
+    }
+    expect_int_eq(snap_write_da(path, &pts), 0);
+    Snapshot s;
+    expect_int_eq(snap_open(&s, path), 0);
+    expect_int_eq(snap_count(&s), 1000);
+    expect(snap_da(&s, u64) == NULL);
+    expect(snap_get(&s, 1, u64) == NULL);
+    const Vector2 *ps = snap_da(&s, Vector2);
+    expect(ps != NULL && ps[999].x == 999 && ps[999].y == -999);
+    snap_close(&s);
+    free(pts.items);
+
+    String2Int *words = calloc(1, sizeof(*words));
+    for (u64 i = 0; i < 5000; ++i) {
+      ht_insert(words, format("w%llu", (unsigned long long)i), i);
+    }
+    ht_insert(words, (char *)"w42", (u64)4242);
+    expect_int_eq(snap_write_ht(path, words), 0);
+    expect_int_eq(snap_open(&s, path), 0);
+    expect_int_eq(snap_count(&s), 5000);
+    for (u64 i = 0; i < 5000; ++i) {
+      const u64 *v = snap_get(&s, format("w%llu", (unsigned long long)i), u64);
+      expect(v != NULL && *v == (i == 42 ? 4242 : i));
+    }
+    expect(snap_get(&s, "w5000", u64) == NULL);
+    expect(snap_get(&s, (u64)7, u64) == NULL);
+    expect(snap_da(&s, u64) == NULL);
+    snap_close(&s);
+
+    Vector22Int *cells = calloc(1, sizeof(*cells));
+    for (ssize_t i = 0; i < 300; ++i) {
+      ht_insert(cells, ((Vector2){i, i * 2}), (u64)i * 3);
+    }
+    expect_int_eq(snap_write_ht(path, cells), 0);
+    expect_int_eq(snap_open(&s, path), 0);
+    const u64 *v = snap_get(&s, ((Vector2){100, 200}), u64);
+    expect(v != NULL && *v == 300);
+    expect(snap_get(&s, ((Vector2){100, 201}), u64) == NULL);
+    expect(snap_get(&s, "w1", u64) == NULL);
+    expect(snap_get(&s, ((Vector2){100, 200}), u32) == NULL);
+    Snap_Header h = *s.h;
+    snap_close(&s);
+
+    /* An index without empty slots must not make lookups spin */
+    fd = open(path, O_RDWR);
+    for (u64 i = 0; i < h.slots; ++i) {
+      u32 one = 1;
+      expect(pwrite(fd, &one, sizeof(one), h.index + i * sizeof(one)) == 4);
+    }
+    close(fd);
+    expect_int_eq(snap_open(&s, path), 0);
+    expect(snap_get(&s, ((Vector2){100, 201}), u64) == NULL);
+    snap_close(&s);
+
+    FILE *fp = fopen(path, "r+");
+    fseek(fp, 0, SEEK_END);
+    expect(ftruncate(fileno(fp), ftell(fp) - 1) == 0);
+    fclose(fp);
+    expect_int_eq(snap_open(&s, path), EINVAL);
+    expect(snap_open(&s, "/nonexistent/snapshot") == ENOENT);
+    unlink(path);
+
+    free_ht(words);
+    free_ht(cells);
+  }
+
+  { /* Profiling */
+    for (int i = 1; i <= 1000; ++i) {
+      prof_count("test.events");
+      prof_record("test.latency", i);
+    }
+    {
+      prof_scope("test.scope");
+      prof_add("test.events", 5);
+    }
+    expect(prof_counter("test.events") == 1005);
+    expect(prof_counter("da_grow") > 0);
+    expect(prof_counter("sb_read_file.bytes") > 0);
+
+    Prof_Hist h = prof_hist("test.latency");
+    expect(h.count == 1000 && h.min == 1 && h.max == 1000);
+    u64 p50 = prof_percentile(&h, 50), p99 = prof_percentile(&h, 99);
+    expect(p50 <= 500 && p50 >= 500 - 500 / 8);
+    expect(p99 <= 990 && p99 >= 990 - 990 / 8);
+    expect_int_eq(prof_percentile(&h, 0.1), 1);
+    expect(prof_hist("test.scope").count == 1);
+    expect(prof_hist("sb_read_file").count > 0);
+
+    char *out;
+    size_t len;
+    FILE *fp = open_memstream(&out, &len);
+    prof_dump(fp);
+    fclose(fp);
+    expect(strstr(out, "test.events") && strstr(out, "p99"));
+    free(out);
+
+    prof_reset();
+    expect(prof_counter("test.events") == 0);
+  }
 }